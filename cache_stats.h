@@ -0,0 +1,136 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace navitia {
+
+// Counter written by only one thread at a time (under a lock for
+// example), that any thread can read without a lock.
+class RelaxedCounter {
+public:
+    RelaxedCounter() = default;
+    RelaxedCounter(const RelaxedCounter& other) : value(other.get()) {}
+    RelaxedCounter& operator=(const RelaxedCounter& other) {
+        value.store(other.get(), std::memory_order_relaxed);
+        return *this;
+    }
+    RelaxedCounter& operator=(size_t v) {
+        value.store(v, std::memory_order_relaxed);
+        return *this;
+    }
+    RelaxedCounter& operator++() {
+        // no need of an atomic increment with only one writer
+        value.store(get() + 1, std::memory_order_relaxed);
+        return *this;
+    }
+    size_t get() const { return value.load(std::memory_order_relaxed); }
+    operator size_t() const { return get(); }
+
+private:
+    std::atomic<size_t> value{0};
+};
+
+// Histogram of durations, that can be filled by several threads.
+// The bucket i counts the durations lower than 2^i microseconds
+// (and greater than the previous bucket).
+class LatencyHistogram {
+public:
+    static constexpr size_t nb_buckets = 32;
+
+    LatencyHistogram() {
+        for (auto& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+    LatencyHistogram(const LatencyHistogram& other) : total_ns(other.total_ns.load(std::memory_order_relaxed)) {
+        for (size_t i = 0; i < nb_buckets; ++i) {
+            buckets[i].store(other.buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void record(std::chrono::nanoseconds duration) {
+        const auto us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+        size_t bucket = 0;
+        while (bucket < nb_buckets - 1 && (uint64_t(1) << bucket) <= us) {
+            ++bucket;
+        }
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        total_ns.fetch_add(uint64_t(duration.count()), std::memory_order_relaxed);
+    }
+
+    std::vector<size_t> counts() const {
+        std::vector<size_t> res;
+        for (const auto& bucket : buckets) {
+            res.push_back(bucket.load(std::memory_order_relaxed));
+        }
+        return res;
+    }
+
+    std::chrono::microseconds total() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::nanoseconds(total_ns.load(std::memory_order_relaxed)));
+    }
+
+private:
+    std::array<std::atomic<size_t>, nb_buckets> buckets;
+    std::atomic<uint64_t> total_ns{0};
+};
+
+// Snapshot of the state of a Lru or a ConcurrentLru
+struct LruStats {
+    size_t nb_calls = 0;
+    size_t nb_hits = 0;
+    size_t nb_misses = 0;
+    size_t nb_evictions = 0;
+    size_t nb_admission_rejected = 0;
+    size_t size = 0;
+    size_t max_size = 0;
+    // ConcurrentLru only
+    size_t nb_front_cache_hits = 0;
+    size_t nb_refresh = 0;
+
+    // durations of the executions of the function, see LatencyHistogram
+    std::vector<size_t> compute_histogram;
+    std::chrono::microseconds compute_time = std::chrono::microseconds::zero();
+    // ConcurrentLru only: time spent by the callers waiting for a value
+    // computed by another thread, and waiting for the lock
+    std::chrono::microseconds future_wait_time = std::chrono::microseconds::zero();
+    std::chrono::microseconds lock_wait_time = std::chrono::microseconds::zero();
+};
+
+}  // namespace navitia
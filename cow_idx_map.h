@@ -0,0 +1,164 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+
+#include <boost/iterator/iterator_facade.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace navitia {
+
+template <typename K, typename Map>
+class CowIdxMapIterator : public boost::iterator_facade<CowIdxMapIterator<K, Map>,
+                                                        std::pair<const K, const typename Map::mapped_type&>,
+                                                        boost::random_access_traversal_tag,
+                                                        std::pair<const K, const typename Map::mapped_type&>> {
+public:
+    using difference_type = std::ptrdiff_t;
+
+    inline CowIdxMapIterator() = default;
+    inline CowIdxMapIterator(const idx_t& i, const Map* m) : idx(i), map(m) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    inline void increment() { ++idx; }
+    inline void decrement() { --idx; }
+    inline void advance(difference_type n) { idx += n; }
+    inline difference_type distance_to(const CowIdxMapIterator& other) const {
+        return difference_type(other.idx) - difference_type(idx);
+    }
+    inline bool equal(const CowIdxMapIterator& other) const { return idx == other.idx; }
+    inline std::pair<const K, const typename Map::mapped_type&> dereference() const { return {K(idx), (*map)[K(idx)]}; }
+
+    idx_t idx = 0;
+    const Map* map = nullptr;
+};
+
+/*
+ * IdxMap with copy on write pages
+ *
+ * The values are stored in pages of page_size values, shared between
+ * the copies of the map. A copy, like snapshot(), only copies the
+ * pointers to the pages, and a write clones the page of the value if it
+ * is shared with another copy.
+ *
+ * The writer can thus give snapshots to readers in other threads and
+ * keep updating its map: the snapshots are never modified. A map must
+ * only be modified by one thread, and read through a const reference
+ * to avoid cloning the pages.
+ */
+template <typename T, typename V, size_t page_size = 1024>
+struct CowIdxMap {
+    static_assert(page_size > 0, "the pages can't be empty");
+
+    using key_type = Idx<T>;
+    using mapped_type = V;
+    using const_iterator = CowIdxMapIterator<key_type, CowIdxMap>;
+    using iterator = const_iterator;
+
+    inline CowIdxMap() = default;
+    inline CowIdxMap(const std::vector<T*>& c, const V& val = V()) { assign(c.size(), val); }
+    inline CowIdxMap(const std::vector<T>& c, const V& val = V()) { assign(c.size(), val); }
+    inline CowIdxMap(const size_t size, const V& val = V()) { assign(size, val); }
+
+    inline friend void swap(CowIdxMap& lhs, CowIdxMap& rhs) {
+        using std::swap;
+        swap(lhs.pages, rhs.pages);
+        swap(lhs.nb, rhs.nb);
+    }
+
+    // initialize the map with the number of element
+    // we give the container for type checking
+    inline void assign(const std::vector<T*>& c, const V& val = V()) { assign(c.size(), val); }
+    inline void assign(const std::vector<T>& c, const V& val = V()) { assign(c.size(), val); }
+    template <typename U>
+    inline void assign(const IdxMap<T, U>& c, const V& val = V()) {
+        assign(c.size(), val);
+    }
+    inline void assign(const size_t size, const V& val = V()) {
+        pages.clear();
+        pages.reserve((size + page_size - 1) / page_size);
+        for (size_t begin = 0; begin < size; begin += page_size) {
+            pages.push_back(std::make_shared<Page>(std::min(page_size, size - begin), val));
+        }
+        nb = size;
+    }
+
+    // a copy of the map sharing all its pages, not modified by the writes in the map
+    inline CowIdxMap snapshot() const { return *this; }
+
+    // accessors
+    inline size_t size() const { return nb; }
+    inline size_t nb_pages() const { return pages.size(); }
+    inline const V& operator[](const Idx<T>& idx) const { return (*pages[idx.val / page_size])[idx.val % page_size]; }
+    // clone the page of idx if it is shared
+    inline V& operator[](const Idx<T>& idx) {
+        auto& page = pages[idx.val / page_size];
+        if (page.use_count() > 1) {
+            page = std::make_shared<Page>(*page);
+        } else {
+            // use_count() is a relaxed load: the reads of a snapshot released by
+            // another thread must happen before writing in place
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return (*page)[idx.val % page_size];
+    }
+    inline const V& at(const Idx<T>& idx) const { return (*this)[Idx<T>(check(idx))]; }
+    inline V& at(const Idx<T>& idx) { return (*this)[Idx<T>(check(idx))]; }
+
+    // iterator getters, the iteration is read only
+    inline const_iterator begin() const { return const_iterator(0, this); }
+    inline const_iterator end() const { return const_iterator(idx_t(nb), this); }
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
+
+private:
+    using Page = std::vector<V>;
+
+    // the pages are never modified while they are shared
+    std::vector<std::shared_ptr<Page>> pages;
+    size_t nb = 0;
+
+    inline idx_t check(const Idx<T>& idx) const {
+        if (idx.val >= nb) {
+            throw std::out_of_range("CowIdxMap::at");
+        }
+        return idx.val;
+    }
+};
+
+}  // namespace navitia
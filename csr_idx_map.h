@@ -0,0 +1,166 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+#include "utils/serialization_vector.h"
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/range/iterator_range_core.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+namespace navitia {
+
+template <typename K, typename U>
+class CsrIdxMapIterator : public boost::iterator_facade<CsrIdxMapIterator<K, U>,
+                                                        std::pair<const K, boost::iterator_range<const U*>>,
+                                                        boost::random_access_traversal_tag,
+                                                        std::pair<const K, boost::iterator_range<const U*>>> {
+public:
+    using difference_type = std::ptrdiff_t;
+
+    inline CsrIdxMapIterator() = default;
+    inline CsrIdxMapIterator(const idx_t& i, const idx_t* o, const U* v) : idx(i), offsets(o), values(v) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    inline void increment() { ++idx; }
+    inline void decrement() { --idx; }
+    inline void advance(difference_type n) { idx += n; }
+    inline difference_type distance_to(const CsrIdxMapIterator& other) const {
+        return difference_type(other.idx) - difference_type(idx);
+    }
+    inline bool equal(const CsrIdxMapIterator& other) const { return idx == other.idx; }
+    inline std::pair<const K, boost::iterator_range<const U*>> dereference() const {
+        return {K(idx), boost::make_iterator_range(values + offsets[idx], values + offsets[idx + 1])};
+    }
+
+    idx_t idx = 0;
+    const idx_t* offsets = nullptr;
+    const U* values = nullptr;
+};
+
+/*
+ * Read only compressed sparse row version of IdxMap<T, std::vector<U>>
+ *
+ * All the values are stored one after the other in one vector, the
+ * values of the key i being between offsets[i] and offsets[i + 1].
+ * There is thus no per key allocation, and iterating over the
+ * values of consecutive keys reads contiguous memory.
+ */
+template <typename T, typename U>
+struct CsrIdxMap {
+    using key_type = Idx<T>;
+    using value_type = U;
+    using range = boost::iterator_range<const U*>;
+    using iterator = CsrIdxMapIterator<key_type, U>;
+    using const_iterator = iterator;
+
+    inline CsrIdxMap() = default;
+    // build from the jagged form
+    inline explicit CsrIdxMap(const IdxMap<T, std::vector<U>>& jagged) {
+        offsets.reserve(jagged.size() + 1);
+        size_t nb_values = 0;
+        for (const auto& v : jagged.values()) {
+            nb_values += v.size();
+        }
+        check_nb_values(nb_values);
+        flat_values.reserve(nb_values);
+        for (const auto& v : jagged.values()) {
+            offsets.push_back(idx_t(flat_values.size()));
+            flat_values.insert(flat_values.end(), v.begin(), v.end());
+        }
+        offsets.push_back(idx_t(flat_values.size()));
+    }
+
+    inline friend void swap(CsrIdxMap& lhs, CsrIdxMap& rhs) {
+        using std::swap;
+        swap(lhs.offsets, rhs.offsets);
+        swap(lhs.flat_values, rhs.flat_values);
+    }
+
+    // accessors
+    inline size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    // total number of values
+    inline size_t nb_values() const { return flat_values.size(); }
+    inline range operator[](const Idx<T>& idx) const {
+        return boost::make_iterator_range(flat_values.data() + offsets[idx.val],
+                                          flat_values.data() + offsets[idx.val + 1]);
+    }
+    inline range at(const Idx<T>& idx) const {
+        if (idx.val >= size()) {
+            throw std::out_of_range("CsrIdxMap::at");
+        }
+        return (*this)[idx];
+    }
+
+    // iterator getters, yielding the pairs (key, range of values)
+    inline const_iterator begin() const { return const_iterator(0, offsets.data(), flat_values.data()); }
+    inline const_iterator end() const { return const_iterator(idx_t(size()), offsets.data(), flat_values.data()); }
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
+
+    // iterate on all the values of all the keys
+    inline range values() const {
+        return boost::make_iterator_range(flat_values.data(), flat_values.data() + flat_values.size());
+    }
+
+    template <class Archive>
+    void save(Archive& ar, const unsigned int) const {
+        ar& offsets& flat_values;
+    }
+    template <class Archive>
+    void load(Archive& ar, const unsigned int) {
+        ar& offsets& flat_values;
+        if (!offsets.empty() && offsets.back() != flat_values.size()) {
+            throw std::runtime_error("CsrIdxMap: offsets and values do not match");
+        }
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+private:
+    // size() + 1 offsets, or none when the map is empty
+    std::vector<idx_t> offsets;
+    std::vector<U> flat_values;
+
+    static inline void check_nb_values(const size_t nb) {
+        if (nb >= size_t(std::numeric_limits<idx_t>::max())) {
+            throw std::out_of_range("CsrIdxMap: too many values");
+        }
+    }
+};
+
+}  // namespace navitia
@@ -29,11 +29,17 @@ www.navitia.io
 */
 
 #pragma once
+#include "utils/serialization_vector.h"
+
 #include <boost/range/iterator_range_core.hpp>
 
 #include <vector>
 #include <iterator>
 #include <iostream>
+#include <stdexcept>
+#include <limits>
+#include <type_traits>
+#include <cstdint>
 
 namespace navitia {
 
@@ -41,20 +47,63 @@ using idx_t = uint32_t;
 const idx_t invalid_idx = std::numeric_limits<idx_t>::max();
 
 // Strong typing of index with a phantom type!
-template <typename T>
+// The width of the index can be reduced for the small collections,
+// to store compact references to their elements.
+template <typename T, typename I = idx_t>
 struct Idx {
-    inline explicit Idx() : val(invalid_idx) {}
-    inline explicit Idx(const idx_t& v) : val(v) {}
-    inline explicit Idx(const T& o) : val(o.idx) {}
-    inline bool is_valid() const { return val != invalid_idx; }
+    static_assert(std::is_unsigned<I>::value, "the index must be an unsigned integer");
+    using value_type = I;
+    static constexpr I invalid = std::numeric_limits<I>::max();
+
+    inline explicit Idx() : val(invalid) {}
+    inline explicit Idx(const I& v) : val(v) {}
+    // throw std::out_of_range if the idx of the object does not fit in I
+    inline explicit Idx(const T& o) : val(narrow(o.idx)) {}
+    inline bool is_valid() const { return val != invalid; }
     inline bool operator==(const Idx& other) const { return val == other.val; }
     inline bool operator!=(const Idx& other) const { return val != other.val; }
     inline bool operator<(const Idx& other) const { return val < other.val; }
-    inline friend std::ostream& operator<<(std::ostream& os, const Idx& idx) { return os << idx.val; }
+    // + to print the small indexes as numbers, not as characters
+    inline friend std::ostream& operator<<(std::ostream& os, const Idx& idx) { return os << +idx.val; }
+
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& val;
+    }
+
+    I val;  // the value of the index
 
-    idx_t val;  // the value of the index
+private:
+    template <typename U>
+    static inline I narrow(const U& v) {
+        if (sizeof(U) > sizeof(I) && v >= U(invalid)) {
+            if (v == std::numeric_limits<U>::max()) {
+                return invalid;
+            }
+            throw std::out_of_range("Idx: the idx of the object does not fit in the index type");
+        }
+        return I(v);
+    }
 };
 
+template <typename T>
+using Idx16 = Idx<T, uint16_t>;
+template <typename T>
+using Idx8 = Idx<T, uint8_t>;
+
+// Conversion of an index to another width, throwing std::out_of_range
+// if the index does not fit. The invalid index stays invalid.
+template <typename J, typename T, typename I>
+inline Idx<T, J> idx_cast(const Idx<T, I>& idx) {
+    if (!idx.is_valid()) {
+        return Idx<T, J>();
+    }
+    if (uint64_t(idx.val) >= uint64_t(Idx<T, J>::invalid)) {
+        throw std::out_of_range("idx_cast: the index does not fit in the target type");
+    }
+    return Idx<T, J>(J(idx.val));
+}
+
 template <typename K, typename I>
 class IdxMapIterator : public boost::iterator_facade<IdxMapIterator<K, I>,
                                                      std::pair<const K, typename std::iterator_traits<I>::reference>,
@@ -91,9 +140,10 @@ private:
 };
 
 // A HashMap with optimal hash!
-template <typename T, typename V>
+// I is the type of the index, see Idx.
+template <typename T, typename V, typename I = idx_t>
 struct IdxMap {
-    using key_type = Idx<T>;
+    using key_type = Idx<T, I>;
     using mapped_type = V;
     using container = std::vector<V>;
     using iterator = IdxMapIterator<key_type, typename container::iterator>;
@@ -102,9 +152,9 @@ struct IdxMap {
     using const_range = boost::iterator_range<typename std::vector<V>::const_iterator>;
 
     inline IdxMap() = default;
-    inline IdxMap(const std::vector<T*>& c, const V& val = V()) : map(c.size(), val) {}
-    inline IdxMap(const std::vector<T>& c, const V& val = V()) : map(c.size(), val) {}
-    inline IdxMap(const size_t size, const V& val = V()) : map(size, val) {}
+    inline IdxMap(const std::vector<T*>& c, const V& val = V()) : map(check_size(c.size()), val) {}
+    inline IdxMap(const std::vector<T>& c, const V& val = V()) : map(check_size(c.size()), val) {}
+    inline IdxMap(const size_t size, const V& val = V()) : map(check_size(size), val) {}
 
     inline friend void swap(IdxMap& lhs, IdxMap& rhs) {
         using std::swap;
@@ -113,28 +163,28 @@ struct IdxMap {
 
     // initialize the map with the number of element
     // we give the container for type checking
-    inline void assign(const std::vector<T*>& c, const V& val = V()) { map.assign(c.size(), val); }
-    inline void assign(const std::vector<T>& c, const V& val = V()) { map.assign(c.size(), val); }
-    template <typename U>
-    inline void assign(const IdxMap<T, U>& c, const V& val = V()) {
-        map.assign(c.size(), val);
+    inline void assign(const std::vector<T*>& c, const V& val = V()) { map.assign(check_size(c.size()), val); }
+    inline void assign(const std::vector<T>& c, const V& val = V()) { map.assign(check_size(c.size()), val); }
+    template <typename U, typename J>
+    inline void assign(const IdxMap<T, U, J>& c, const V& val = V()) {
+        map.assign(check_size(c.size()), val);
     }
 
     // resize the map
-    inline void resize(const size_t size) { map.resize(size); }
-    inline void resize(const std::vector<T*>& c) { map.resize(c.size()); }
-    inline void resize(const std::vector<T>& c) { map.resize(c.size()); }
-    template <typename U>
-    inline void resize(const IdxMap<T, U>& c) {
-        map.resize(c.size());
+    inline void resize(const size_t size) { map.resize(check_size(size)); }
+    inline void resize(const std::vector<T*>& c) { map.resize(check_size(c.size())); }
+    inline void resize(const std::vector<T>& c) { map.resize(check_size(c.size())); }
+    template <typename U, typename J>
+    inline void resize(const IdxMap<T, U, J>& c) {
+        map.resize(check_size(c.size()));
     }
 
     // accessors
     inline size_t size() const { return map.size(); }
-    inline const V& operator[](const Idx<T>& idx) const { return map[idx.val]; }
-    inline V& operator[](const Idx<T>& idx) { return map[idx.val]; }
-    inline V& at(const Idx<T>& idx) { return map.at(idx.val); }
-    inline const V& at(const Idx<T>& idx) const { return map.at(idx.val); }
+    inline const V& operator[](const key_type& idx) const { return map[idx.val]; }
+    inline V& operator[](const key_type& idx) { return map[idx.val]; }
+    inline V& at(const key_type& idx) { return map.at(idx.val); }
+    inline const V& at(const key_type& idx) const { return map.at(idx.val); }
 
     // iterator getters
     inline iterator begin() { return iterator(0, map.begin()); }
@@ -150,8 +200,118 @@ struct IdxMap {
     // iterate on values
     inline range values() { return boost::make_iterator_range(map.begin(), map.end()); }
 
+    // the values are saved as one block by the binary archives when V is
+    // bitwise serializable, see NAVITIA_BITWISE_SERIALIZABLE
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& map;
+        check_size(map.size());
+    }
+
 private:
     container map;
+
+    // all the elements must have a valid index
+    static inline size_t check_size(const size_t size) {
+        if (size > size_t(key_type::invalid)) {
+            throw std::out_of_range("IdxMap: too many elements for the type of the index");
+        }
+        return size;
+    }
+};
+
+template <typename T, typename V>
+using IdxMap16 = IdxMap<T, V, uint16_t>;
+
+/*
+ * IdxMap with a O(1) reset, for per request scratch data
+ *
+ * Each slot is stamped with the generation in which it has been
+ * written. reset() only starts a new generation: the slots of the
+ * previous generations are then read as the default value, so the
+ * cost of a reset does not depend on the size of the map.
+ */
+template <typename T, typename V>
+struct GenerationIdxMap {
+    using key_type = Idx<T>;
+    using mapped_type = V;
+
+    inline GenerationIdxMap() = default;
+    inline GenerationIdxMap(const std::vector<T*>& c, const V& val = V()) : slots(c.size()), default_value(val) {}
+    inline GenerationIdxMap(const std::vector<T>& c, const V& val = V()) : slots(c.size()), default_value(val) {}
+    inline GenerationIdxMap(const size_t size, const V& val = V()) : slots(size), default_value(val) {}
+
+    // initialize the map with the number of element, all the values being val
+    inline void assign(const std::vector<T*>& c, const V& val = V()) { assign(c.size(), val); }
+    inline void assign(const std::vector<T>& c, const V& val = V()) { assign(c.size(), val); }
+    template <typename U>
+    inline void assign(const IdxMap<T, U>& c, const V& val = V()) {
+        assign(c.size(), val);
+    }
+    inline void assign(const size_t size, const V& val = V()) {
+        default_value = val;
+        if (slots.size() != size) {
+            slots.assign(size, Slot());
+            generation = 1;
+        } else {
+            reset();
+        }
+    }
+
+    // all the values are the default value again
+    inline void reset() {
+        if (++generation == 0) {
+            // the generations have wrapped around, the old stamps could be valid again
+            for (auto& slot : slots) {
+                slot.generation = 0;
+            }
+            generation = 1;
+        }
+    }
+
+    // accessors
+    inline size_t size() const { return slots.size(); }
+    inline bool is_set(const Idx<T>& idx) const { return slots[idx.val].generation == generation; }
+    inline const V& operator[](const Idx<T>& idx) const {
+        const auto& slot = slots[idx.val];
+        return slot.generation == generation ? slot.value : default_value;
+    }
+    inline V& operator[](const Idx<T>& idx) {
+        auto& slot = slots[idx.val];
+        if (slot.generation != generation) {
+            slot.value = default_value;
+            slot.generation = generation;
+        }
+        return slot.value;
+    }
+    inline const V& at(const Idx<T>& idx) const { return (*this)[Idx<T>(check(idx))]; }
+    inline V& at(const Idx<T>& idx) { return (*this)[Idx<T>(check(idx))]; }
+    inline const V& get_default() const { return default_value; }
+
+private:
+    struct Slot {
+        V value;
+        uint32_t generation = 0;
+    };
+    std::vector<Slot> slots;
+    V default_value = V();
+    // the generation 0 is never the current one
+    uint32_t generation = 1;
+
+    inline idx_t check(const Idx<T>& idx) const {
+        if (idx.val >= slots.size()) {
+            throw std::out_of_range("GenerationIdxMap::at");
+        }
+        return idx.val;
+    }
 };
 
 }  // namespace navitia
+
+namespace boost {
+namespace serialization {
+// an index is saved as its value, so the vectors of indexes are saved as one block
+template <typename T, typename I>
+struct is_bitwise_serializable<navitia::Idx<T, I>> : public mpl::true_ {};
+}  // namespace serialization
+}  // namespace boost
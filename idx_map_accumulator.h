@@ -0,0 +1,206 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+#include "utils/idx_map_parallel.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace navitia {
+
+constexpr size_t cache_line_size = 64;
+
+// Allocator giving memory aligned on, and padded to, whole cache lines,
+// so that two allocations never share a cache line.
+template <typename T>
+struct CacheLineAllocator {
+    using value_type = T;
+
+    CacheLineAllocator() = default;
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        const size_t size = (n * sizeof(T) + cache_line_size - 1) / cache_line_size * cache_line_size;
+        void* p = nullptr;
+        if (::posix_memalign(&p, cache_line_size, std::max(size, cache_line_size)) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) { std::free(p); }
+
+    template <typename U>
+    bool operator==(const CacheLineAllocator<U>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const CacheLineAllocator<U>&) const {
+        return false;
+    }
+};
+
+/*
+ * Accumulation of the contributions of several threads to an IdxMap
+ *
+ * Each worker adds its contributions to its own partition, without any
+ * synchronization, and the partitions are then merged by merge(). The
+ * values are combined by `reduce(const V&, const V&) -> V`, that must
+ * be associative and commutative (min, max, sum...), with `identity`
+ * as neutral element.
+ *
+ * A dense partition is a vector of all the values, a sparse partition
+ * only stores the indexes it has seen, it is better when each worker
+ * only touches a few indexes. The partitions, and the memory allocated by
+ * each of them, never share a cache line.
+ *
+ * auto acc = make_idx_map_accumulator<StopPoint>(stop_points.size(), nb_threads, 0, std::plus<int>());
+ * // in the worker i
+ * acc.partition(i).add(idx, 1);
+ * // once all the workers are done
+ * const IdxMap<StopPoint, int> counts = acc.merge(nb_threads);
+ */
+template <typename T, typename V, typename Reduce>
+class IdxMapAccumulator {
+public:
+    class alignas(cache_line_size) Partition {
+    public:
+        inline void add(const Idx<T>& idx, const V& v) {
+            if (sparse) {
+                const auto it = sparse_values.emplace(idx.val, v);
+                if (!it.second) {
+                    it.first->second = reduce(it.first->second, v);
+                }
+            } else {
+                auto& value = dense_values[idx.val];
+                value = reduce(value, v);
+            }
+        }
+
+    private:
+        friend class IdxMapAccumulator;
+
+        inline Partition(const Reduce& reduce, bool sparse) : reduce(reduce), sparse(sparse) {}
+
+        Reduce reduce;
+        bool sparse;
+        std::vector<V, CacheLineAllocator<V>> dense_values;
+        // each node of the map takes whole cache lines, as it is written by the worker
+        std::unordered_map<idx_t,
+                           V,
+                           std::hash<idx_t>,
+                           std::equal_to<idx_t>,
+                           CacheLineAllocator<std::pair<const idx_t, V>>>
+            sparse_values;
+        // filled by merge() with the sparse values sorted by index
+        std::vector<std::pair<idx_t, V>, CacheLineAllocator<std::pair<idx_t, V>>> sorted;
+    };
+
+    IdxMapAccumulator(size_t size, size_t nb_partitions, const V& identity, Reduce reduce, bool sparse = false)
+        : size(size), identity(identity), reduce(std::move(reduce)), sparse(sparse) {
+        partitions.reserve(nb_partitions);
+        for (size_t i = 0; i < nb_partitions; ++i) {
+            partitions.push_back(Partition(this->reduce, sparse));
+            if (!sparse) {
+                partitions.back().dense_values.assign(size, identity);
+            }
+        }
+    }
+
+    inline size_t nb_partitions() const { return partitions.size(); }
+    inline Partition& partition(size_t i) { return partitions.at(i); }
+
+    // Reduce all the partitions into one IdxMap, using nb_threads threads
+    // including the calling one. No contribution must be added meanwhile.
+    IdxMap<T, V> merge(size_t nb_threads = 1) {
+        IdxMap<T, V> result(size, identity);
+        if (sparse) {
+            parallel_run(partitions.size(), nb_threads, [&](size_t i) {
+                auto& partition = partitions[i];
+                partition.sorted.assign(partition.sparse_values.begin(), partition.sparse_values.end());
+                std::sort(partition.sorted.begin(), partition.sorted.end(),
+                          [](const std::pair<idx_t, V>& a, const std::pair<idx_t, V>& b) { return a.first < b.first; });
+            });
+        }
+        // the result is split in chunks reduced independently
+        const size_t nb_chunks = (size + chunk_size - 1) / chunk_size;
+        parallel_run(nb_chunks, nb_threads, [&](size_t chunk) {
+            const idx_t begin = idx_t(chunk * chunk_size);
+            const idx_t end = idx_t(std::min(size, (chunk + 1) * chunk_size));
+            for (const auto& partition : partitions) {
+                if (sparse) {
+                    auto it = std::lower_bound(
+                        partition.sorted.begin(), partition.sorted.end(), begin,
+                        [](const std::pair<idx_t, V>& elt, idx_t idx) { return elt.first < idx; });
+                    for (; it != partition.sorted.end() && it->first < end; ++it) {
+                        auto& value = result[Idx<T>(it->first)];
+                        value = reduce(value, it->second);
+                    }
+                } else {
+                    for (idx_t i = begin; i < end; ++i) {
+                        auto& value = result[Idx<T>(i)];
+                        value = reduce(value, partition.dense_values[i]);
+                    }
+                }
+            }
+        });
+        for (auto& partition : partitions) {
+            partition.sorted = {};
+        }
+        return result;
+    }
+
+private:
+    // large enough for the threads to seldom write in the same cache line of the result
+    static constexpr size_t chunk_size = 64 * cache_line_size;
+
+    size_t size;
+    V identity;
+    Reduce reduce;
+    bool sparse;
+    std::vector<Partition, CacheLineAllocator<Partition>> partitions;
+};
+
+template <typename T, typename V, typename Reduce>
+IdxMapAccumulator<T, V, Reduce> make_idx_map_accumulator(size_t size,
+                                                         size_t nb_partitions,
+                                                         const V& identity,
+                                                         Reduce reduce,
+                                                         bool sparse = false) {
+    return IdxMapAccumulator<T, V, Reduce>(size, nb_partitions, identity, std::move(reduce), sparse);
+}
+
+}  // namespace navitia
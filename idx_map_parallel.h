@@ -0,0 +1,180 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+
+#include <boost/range/iterator_range_core.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace navitia {
+
+struct ParallelOptions {
+    // including the calling thread, 0 for the number of cores
+    size_t nb_threads = 0;
+    // number of consecutive indexes given to a thread at once
+    size_t block_size = 1024;
+};
+
+/*
+ * Call f(task) for all the tasks in [0, nb_tasks), using nb_threads
+ * threads including the calling one.
+ *
+ * The threads take the next task from a shared counter as soon as they
+ * are done with the previous one, so a thread with expensive tasks does
+ * not delay the others. If a task throws, the remaining tasks are
+ * skipped and the first exception is rethrown.
+ */
+template <typename F>
+void parallel_run(const size_t nb_tasks, size_t nb_threads, const F& f) {
+    if (nb_threads == 0) {
+        nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&]() {
+        for (size_t i = next++; i < nb_tasks; i = next++) {
+            try {
+                f(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = nb_tasks;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(nb_threads, nb_tasks); ++i) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Call f(begin, end) on blocks of consecutive indexes of [0, size)
+template <typename F>
+void parallel_for_blocks(const size_t size, const ParallelOptions& options, const F& f) {
+    const size_t block_size = std::max<size_t>(1, options.block_size);
+    parallel_run((size + block_size - 1) / block_size, options.nb_threads, [&](size_t block) {
+        f(block * block_size, std::min(size, (block + 1) * block_size));
+    });
+}
+
+// Call f(idx, value) on all the elements of the map
+template <typename T, typename V, typename I, typename F>
+void parallel_for_each(IdxMap<T, V, I>& map, const F& f, const ParallelOptions& options = ParallelOptions()) {
+    parallel_for_blocks(map.size(), options, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto idx = Idx<T, I>(I(i));
+            f(idx, map[idx]);
+        }
+    });
+}
+template <typename T, typename V, typename I, typename F>
+void parallel_for_each(const IdxMap<T, V, I>& map, const F& f, const ParallelOptions& options = ParallelOptions()) {
+    parallel_for_blocks(map.size(), options, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto idx = Idx<T, I>(I(i));
+            f(idx, map[idx]);
+        }
+    });
+}
+
+// Call f(value) on all the values of a random access range, like IdxMap::values()
+template <typename It, typename F>
+void parallel_for_each(const boost::iterator_range<It>& range,
+                       const F& f,
+                       const ParallelOptions& options = ParallelOptions()) {
+    parallel_for_blocks(size_t(range.size()), options, [&](size_t begin, size_t end) {
+        std::for_each(range.begin() + begin, range.begin() + end, f);
+    });
+}
+
+// out[idx] = f(idx, in[idx]) for all the elements of in, out being resized to in
+template <typename T, typename V, typename U, typename I, typename F>
+void parallel_transform(const IdxMap<T, V, I>& in,
+                        IdxMap<T, U, I>& out,
+                        const F& f,
+                        const ParallelOptions& options = ParallelOptions()) {
+    out.resize(in.size());
+    parallel_for_blocks(in.size(), options, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const auto idx = Idx<T, I>(I(i));
+            out[idx] = f(idx, in[idx]);
+        }
+    });
+}
+
+/*
+ * Reduction of all the elements of the map
+ *
+ * Each block is folded from identity with acc = accumulate(acc, idx, value),
+ * then the results of the blocks are combined in the order of the indexes
+ * with acc = combine(acc, block_result), so the result does not depend on
+ * the scheduling of the threads.
+ */
+template <typename T, typename V, typename I, typename Acc, typename Accumulate, typename Combine>
+Acc parallel_reduce(const IdxMap<T, V, I>& map,
+                    const Acc& identity,
+                    const Accumulate& accumulate,
+                    const Combine& combine,
+                    const ParallelOptions& options = ParallelOptions()) {
+    const size_t block_size = std::max<size_t>(1, options.block_size);
+    std::vector<Acc> results((map.size() + block_size - 1) / block_size, identity);
+    parallel_run(results.size(), options.nb_threads, [&](size_t block) {
+        auto& acc = results[block];
+        for (size_t i = block * block_size, end = std::min(map.size(), (block + 1) * block_size); i < end; ++i) {
+            const auto idx = Idx<T, I>(I(i));
+            acc = accumulate(acc, idx, map[idx]);
+        }
+    });
+    Acc result = identity;
+    for (const auto& acc : results) {
+        result = combine(result, acc);
+    }
+    return result;
+}
+
+}  // namespace navitia
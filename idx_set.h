@@ -0,0 +1,224 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+#include "utils/serialization_vector.h"
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/serialization/split_member.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace navitia {
+
+template <typename T>
+class IdxSetIterator
+    : public boost::iterator_facade<IdxSetIterator<T>, Idx<T>, boost::forward_traversal_tag, Idx<T>> {
+public:
+    inline IdxSetIterator() = default;
+    inline IdxSetIterator(const uint64_t* w, size_t idx, size_t nb) : words(w), word_idx(idx), nb_words(nb) {
+        if (word_idx < nb_words) {
+            current = words[word_idx];
+            skip_empty_words();
+        }
+    }
+
+private:
+    friend class boost::iterator_core_access;
+
+    inline void skip_empty_words() {
+        while (current == 0 && ++word_idx < nb_words) {
+            current = words[word_idx];
+        }
+    }
+    inline void increment() {
+        // clear the lowest set bit
+        current &= current - 1;
+        skip_empty_words();
+    }
+    inline bool equal(const IdxSetIterator& other) const {
+        return word_idx == other.word_idx && current == other.current;
+    }
+    inline Idx<T> dereference() const { return Idx<T>(idx_t(word_idx * 64 + __builtin_ctzll(current))); }
+
+    const uint64_t* words = nullptr;
+    size_t word_idx = 0;
+    size_t nb_words = 0;
+    uint64_t current = 0;
+};
+
+/*
+ * A set of Idx<T>, stored as a dense bitset
+ *
+ * The set operations work on whole 64 bits words, in loops simple
+ * enough to be vectorized by the compiler. The iteration skips the
+ * empty words and yields the Idx<T> of the set bits in increasing
+ * order.
+ *
+ * The sets used in a set operation must have the same size.
+ */
+template <typename T>
+class IdxSet {
+public:
+    using key_type = Idx<T>;
+    using const_iterator = IdxSetIterator<T>;
+    using iterator = const_iterator;
+
+    inline IdxSet() = default;
+    inline IdxSet(const std::vector<T*>& c) { resize(c.size()); }
+    inline IdxSet(const std::vector<T>& c) { resize(c.size()); }
+    inline IdxSet(const size_t size) { resize(size); }
+
+    // initialize the set with the number of element, all the elements being absent
+    inline void assign(const std::vector<T*>& c) { assign(c.size()); }
+    inline void assign(const std::vector<T>& c) { assign(c.size()); }
+    template <typename U>
+    inline void assign(const IdxMap<T, U>& c) {
+        assign(c.size());
+    }
+    inline void assign(const size_t size) {
+        nb_bits = size;
+        words.assign(nb_words(size), 0);
+    }
+
+    // the new elements are absent
+    inline void resize(const size_t size) {
+        nb_bits = size;
+        words.resize(nb_words(size), 0);
+        clear_padding();
+    }
+
+    // number of possible elements
+    inline size_t size() const { return nb_bits; }
+    // number of elements in the set
+    inline size_t count() const {
+        size_t res = 0;
+        for (const auto w : words) {
+            res += size_t(__builtin_popcountll(w));
+        }
+        return res;
+    }
+    inline bool empty() const {
+        for (const auto w : words) {
+            if (w != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline bool contains(const Idx<T>& idx) const { return (words[idx.val / 64] >> (idx.val % 64)) & 1; }
+    inline void insert(const Idx<T>& idx) { words[idx.val / 64] |= uint64_t(1) << (idx.val % 64); }
+    inline void erase(const Idx<T>& idx) { words[idx.val / 64] &= ~(uint64_t(1) << (idx.val % 64)); }
+    inline void clear() { std::fill(words.begin(), words.end(), 0); }
+    // insert all the possible elements
+    inline void fill() {
+        std::fill(words.begin(), words.end(), ~uint64_t(0));
+        clear_padding();
+    }
+
+    // union
+    inline IdxSet& operator|=(const IdxSet& other) {
+        uint64_t* w = words.data();
+        const uint64_t* o = other.words.data();
+        for (size_t i = 0, n = std::min(words.size(), other.words.size()); i < n; ++i) {
+            w[i] |= o[i];
+        }
+        return *this;
+    }
+    // intersection
+    inline IdxSet& operator&=(const IdxSet& other) {
+        uint64_t* w = words.data();
+        const uint64_t* o = other.words.data();
+        for (size_t i = 0, n = std::min(words.size(), other.words.size()); i < n; ++i) {
+            w[i] &= o[i];
+        }
+        return *this;
+    }
+    // difference
+    inline IdxSet& operator-=(const IdxSet& other) {
+        uint64_t* w = words.data();
+        const uint64_t* o = other.words.data();
+        for (size_t i = 0, n = std::min(words.size(), other.words.size()); i < n; ++i) {
+            w[i] &= ~o[i];
+        }
+        return *this;
+    }
+    inline friend IdxSet operator|(IdxSet lhs, const IdxSet& rhs) { return lhs |= rhs; }
+    inline friend IdxSet operator&(IdxSet lhs, const IdxSet& rhs) { return lhs &= rhs; }
+    inline friend IdxSet operator-(IdxSet lhs, const IdxSet& rhs) { return lhs -= rhs; }
+    inline bool operator==(const IdxSet& other) const { return nb_bits == other.nb_bits && words == other.words; }
+    inline bool operator!=(const IdxSet& other) const { return !(*this == other); }
+
+    inline friend void swap(IdxSet& lhs, IdxSet& rhs) {
+        using std::swap;
+        swap(lhs.nb_bits, rhs.nb_bits);
+        swap(lhs.words, rhs.words);
+    }
+
+    // iterate on the elements of the set
+    inline const_iterator begin() const { return const_iterator(words.data(), 0, words.size()); }
+    inline const_iterator end() const { return const_iterator(words.data(), words.size(), words.size()); }
+
+    // the underlying words, the bit i of the word j being the element 64 * j + i
+    inline const std::vector<uint64_t>& get_words() const { return words; }
+
+    template <class Archive>
+    void save(Archive& ar, const unsigned int) const {
+        ar& nb_bits& words;
+    }
+    template <class Archive>
+    void load(Archive& ar, const unsigned int) {
+        ar& nb_bits& words;
+        if (words.size() != nb_words(nb_bits)) {
+            throw std::runtime_error("IdxSet: invalid number of words");
+        }
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+private:
+    size_t nb_bits = 0;
+    std::vector<uint64_t> words;
+
+    static inline size_t nb_words(const size_t nb) { return (nb + 63) / 64; }
+
+    // the bits after the last element must stay unset, for count() and the iteration
+    inline void clear_padding() {
+        if (nb_bits % 64 != 0) {
+            words.back() &= (uint64_t(1) << (nb_bits % 64)) - 1;
+        }
+    }
+};
+
+}  // namespace navitia
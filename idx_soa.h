@@ -0,0 +1,192 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/range/iterator_range_core.hpp>
+
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace navitia {
+
+template <typename K, typename Ref, typename Soa>
+class IdxSoAIterator
+    : public boost::iterator_facade<IdxSoAIterator<K, Ref, Soa>, std::pair<const K, Ref>,
+                                    boost::random_access_traversal_tag, std::pair<const K, Ref>> {
+public:
+    using difference_type = std::ptrdiff_t;
+
+    inline IdxSoAIterator() = default;
+    inline IdxSoAIterator(const idx_t& i, Soa* s) : idx(i), soa(s) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    inline void increment() { ++idx; }
+    inline void decrement() { --idx; }
+    inline void advance(difference_type n) { idx += n; }
+    inline difference_type distance_to(const IdxSoAIterator& other) const {
+        return difference_type(other.idx) - difference_type(idx);
+    }
+    inline bool equal(const IdxSoAIterator& other) const { return idx == other.idx; }
+    inline std::pair<const K, Ref> dereference() const { return {K(idx), (*soa)[K(idx)]}; }
+
+    idx_t idx = 0;
+    Soa* soa = nullptr;
+};
+
+/*
+ * IdxMap of several fields, stored as a structure of arrays
+ *
+ * Each field is stored in its own vector, so a loop reading only one
+ * field reads contiguous memory, and can be vectorized, instead of
+ * loading the whole structure.
+ *
+ * soa.get<I>(idx) is the field I of idx, soa[idx] is a tuple of
+ * references to all the fields of idx, and soa.field<I>() is the range
+ * of the field I of all the indexes.
+ */
+template <typename T, typename... Fields>
+struct IdxSoA {
+    using key_type = Idx<T>;
+    using value_type = std::tuple<Fields...>;
+    using reference = std::tuple<Fields&...>;
+    using const_reference = std::tuple<const Fields&...>;
+    using iterator = IdxSoAIterator<key_type, reference, IdxSoA>;
+    using const_iterator = IdxSoAIterator<key_type, const_reference, const IdxSoA>;
+    template <size_t I>
+    using field_type = typename std::tuple_element<I, value_type>::type;
+    template <size_t I>
+    using range = boost::iterator_range<typename std::vector<field_type<I>>::iterator>;
+    template <size_t I>
+    using const_range = boost::iterator_range<typename std::vector<field_type<I>>::const_iterator>;
+
+    inline IdxSoA() = default;
+    inline IdxSoA(const std::vector<T*>& c, const value_type& val = value_type()) { assign(c.size(), val); }
+    inline IdxSoA(const std::vector<T>& c, const value_type& val = value_type()) { assign(c.size(), val); }
+    inline IdxSoA(const size_t size, const value_type& val = value_type()) { assign(size, val); }
+
+    inline friend void swap(IdxSoA& lhs, IdxSoA& rhs) {
+        using std::swap;
+        swap(lhs.fields, rhs.fields);
+        swap(lhs.nb, rhs.nb);
+    }
+
+    // initialize the map with the number of element
+    // we give the container for type checking
+    inline void assign(const std::vector<T*>& c, const value_type& val = value_type()) { assign(c.size(), val); }
+    inline void assign(const std::vector<T>& c, const value_type& val = value_type()) { assign(c.size(), val); }
+    template <typename U>
+    inline void assign(const IdxMap<T, U>& c, const value_type& val = value_type()) {
+        assign(c.size(), val);
+    }
+    inline void assign(const size_t size, const value_type& val = value_type()) {
+        assign_impl(size, val, std::index_sequence_for<Fields...>());
+        nb = size;
+    }
+
+    // resize the map
+    inline void resize(const size_t size) {
+        resize_impl(size, std::index_sequence_for<Fields...>());
+        nb = size;
+    }
+
+    // accessors
+    inline size_t size() const { return nb; }
+    template <size_t I>
+    inline field_type<I>& get(const Idx<T>& idx) {
+        return std::get<I>(fields)[idx.val];
+    }
+    template <size_t I>
+    inline const field_type<I>& get(const Idx<T>& idx) const {
+        return std::get<I>(fields)[idx.val];
+    }
+    inline reference operator[](const Idx<T>& idx) { return at_impl(idx.val, std::index_sequence_for<Fields...>()); }
+    inline const_reference operator[](const Idx<T>& idx) const {
+        return at_impl(idx.val, std::index_sequence_for<Fields...>());
+    }
+    inline reference at(const Idx<T>& idx) { return (*this)[Idx<T>(check(idx))]; }
+    inline const_reference at(const Idx<T>& idx) const { return (*this)[Idx<T>(check(idx))]; }
+
+    // iterator getters
+    inline iterator begin() { return iterator(0, this); }
+    inline iterator end() { return iterator(idx_t(nb), this); }
+    inline const_iterator begin() const { return const_iterator(0, this); }
+    inline const_iterator end() const { return const_iterator(idx_t(nb), this); }
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
+
+    // iterate on the values of one field
+    template <size_t I>
+    inline range<I> field() {
+        return boost::make_iterator_range(std::get<I>(fields).begin(), std::get<I>(fields).end());
+    }
+    template <size_t I>
+    inline const_range<I> field() const {
+        return boost::make_iterator_range(std::get<I>(fields).cbegin(), std::get<I>(fields).cend());
+    }
+
+private:
+    std::tuple<std::vector<Fields>...> fields;
+    size_t nb = 0;
+
+    // pack expansion in a braced list to call a function on each field, in order
+    using expand = int[];
+
+    template <size_t... Is>
+    inline void assign_impl(const size_t size, const value_type& val, std::index_sequence<Is...>) {
+        (void)expand{0, (std::get<Is>(fields).assign(size, std::get<Is>(val)), 0)...};
+    }
+    template <size_t... Is>
+    inline void resize_impl(const size_t size, std::index_sequence<Is...>) {
+        (void)expand{0, (std::get<Is>(fields).resize(size), 0)...};
+    }
+    template <size_t... Is>
+    inline reference at_impl(const idx_t i, std::index_sequence<Is...>) {
+        return reference(std::get<Is>(fields)[i]...);
+    }
+    template <size_t... Is>
+    inline const_reference at_impl(const idx_t i, std::index_sequence<Is...>) const {
+        return const_reference(std::get<Is>(fields)[i]...);
+    }
+    inline idx_t check(const Idx<T>& idx) const {
+        if (idx.val >= nb) {
+            throw std::out_of_range("IdxSoA::at");
+        }
+        return idx.val;
+    }
+};
+
+}  // namespace navitia
@@ -28,7 +28,11 @@ https://groups.google.com/d/forum/navitia
 www.navitia.io
 */
 
+#pragma once
 #include "functions.h"
+#include "tiny_lfu.h"
+#include "cache_stats.h"
+#include "serialization_vector.h"
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
@@ -36,34 +40,97 @@ www.navitia.io
 #include <boost/multi_index/member.hpp>
 #include <boost/type_traits/remove_cv.hpp>
 #include <boost/type_traits/remove_reference.hpp>
-#include <boost/range/adaptor/reversed.hpp>
 
+#include <map>
+#include <atomic>
 #include <mutex>
+#include <thread>
+#include <chrono>
 #include <future>
 #include <stdexcept>
 
 namespace navitia {
 
 // forward declare
-template <typename T>
+template <typename T, typename A>
 struct ConcurrentLru;
 
+struct WarmupOptions {
+    // number of threads computing the values, including the calling one
+    size_t nb_threads = 1;
+    // stop computing the values after this duration, zero for no limit
+    // the keys not computed in time are still cached, and lazily computed when used
+    std::chrono::milliseconds time_budget = std::chrono::milliseconds::zero();
+};
+
+// Storage of the values evicted from a ConcurrentLru, checked on a miss
+// before computing the value. It must be usable by several threads.
+// Each value is stored with the time when it was computed, on the wall
+// clock as the values can outlive the process. With a ttl, the cache
+// does not use the values older than the ttl.
+template <typename Key, typename Value>
+struct SecondTier {
+    using time_point = std::chrono::system_clock::time_point;
+    virtual ~SecondTier() = default;
+    // nullptr if the key is not stored, else the value and the time when it was computed
+    virtual std::shared_ptr<const Value> get(const Key& key, time_point& computed) = 0;
+    virtual void put(const Key& key, const Value& value, time_point computed) = 0;
+    virtual void clear() = 0;
+};
+
+struct WarmupStats {
+    size_t nb_keys = 0;
+    size_t nb_warmed = 0;
+    std::chrono::milliseconds elapsed = std::chrono::milliseconds::zero();
+};
+
 // Encapsulate a unary function, and provide a least recently used
 // cache.  The function must be pure (same argument => same result),
 // and a Lru object must not be shared across threads.
-template <typename F>
+//
+// The Admission policy decides if a new entry is allowed to evict
+// the least recently used one when the cache is full (see TinyLfu).
+// A rejected value is returned but not cached, the returned reference
+// is then only valid until the next call.
+//
+// With the cost aware eviction, the cache follows the GreedyDual
+// algorithm: each entry has a priority equal to the cost of its
+// computation (the duration of f(arg)) plus an inflation value, and
+// the entry with the lowest priority is evicted. The inflation value
+// is raised to the priority of each evicted entry, so the expensive
+// entries that are not used anymore eventually leave the cache.
+//
+// With a ttl, an entry older than the ttl is not used anymore: it is
+// computed again on the next call.
+template <typename F, typename Admission = NoAdmission>
 class Lru {
-private:
+public:
     typedef typename boost::remove_cv<typename boost::remove_reference<typename F::argument_type>::type>::type key_type;
+
+private:
     using mapped_type =
         typename boost::remove_cv<typename boost::remove_reference<typename F::result_type>::type>::type;
-    using value_type = std::pair<const key_type, mapped_type>;
+    using clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Entry(const key_type& k, mapped_type v, double c, double p)
+            : key(k), value(std::move(v)), cost(c), priority(p), created(clock::now()) {}
+        const key_type key;
+        mapped_type value;
+        // duration of the computation in microseconds, and GreedyDual priority
+        double cost;
+        double priority;
+        clock::time_point created;
+    };
+    using value_type = Entry;
     using Cache = boost::multi_index_container<
         value_type,
         boost::multi_index::indexed_by<
             boost::multi_index::sequenced<>,
             boost::multi_index::ordered_unique<
-                boost::multi_index::member<value_type, const key_type, &value_type::first>>>>;
+                boost::multi_index::member<value_type, const key_type, &value_type::key>>,
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::member<value_type, double, &value_type::priority>>>>;
 
     // the encapsulate function
     F f;
@@ -74,82 +141,685 @@ private:
     // the cache, mutable because side effect are not visible from the
     // exterior because of the purity of f
     mutable Cache cache;
-    mutable size_t nb_cache_miss = 0;
-    mutable size_t nb_calls = 0;
+    // the counters can be read without the lock of a ConcurrentLru
+    mutable RelaxedCounter nb_cache_miss;
+    mutable RelaxedCounter nb_calls;
+    mutable RelaxedCounter nb_evictions;
+    mutable RelaxedCounter nb_entries;
+    mutable LatencyHistogram compute_histogram;
+
+    mutable Admission admission;
+    mutable RelaxedCounter nb_admission_rejected;
+    // last value refused by the admission policy
+    mutable std::shared_ptr<const value_type> rejected;
+
+    bool cost_aware = false;
+    // GreedyDual inflation value
+    mutable double inflation = 0;
+    // With a ConcurrentLru, f only builds a future: the cost of a new entry
+    // is set once its value is computed, and is the mean cost until then
+    bool deferred_cost = false;
+    mutable double total_cost = 0;
+    mutable size_t nb_costs = 0;
+
+    double mean_cost() const { return nb_costs == 0 ? 0 : total_cost / double(nb_costs); }
+
+    // maximum age of the entries, zero for no expiration
+    clock::duration ttl = clock::duration::zero();
+
+    // the entries evicted to make room for new ones, if they are kept
+    bool keep_evicted = false;
+    mutable std::vector<value_type> evicted;
 
     std::vector<key_type> keys() const {
         auto& list = cache.template get<0>();
         std::vector<key_type> result;
         for (const auto& p : list) {
-            result.push_back(p.first);
+            result.push_back(p.key);
         }
         return result;
     }
 
-    template <typename T>
+    // the entry to evict when the cache is full
+    typename Cache::template nth_index<0>::type::iterator victim() const {
+        if (cost_aware) {
+            return cache.template project<0>(cache.template get<2>().begin());
+        }
+        return std::prev(cache.template get<0>().end());
+    }
+
+    // return the cached entry of the key, and put it at the begining
+    // of the cache, nullptr if the key is not cached
+    const value_type* find(const key_type& key) const {
+        auto& list = cache.template get<0>();
+        auto& map = cache.template get<1>();
+        const auto search = map.find(key);
+        if (search == map.end()) {
+            return nullptr;
+        }
+        const auto it = cache.template project<0>(search);
+        list.relocate(list.begin(), it);
+        if (cost_aware) {
+            list.modify(it, [&](value_type& e) { e.priority = inflation + e.cost; });
+        }
+        return &*it;
+    }
+
+    // insert a new value at the begining of the cache, if the admission
+    // policy allows it to take the place of the entry to evict
+    const value_type& insert(const key_type& key, mapped_type value, double cost = 0) const {
+        auto& list = cache.template get<0>();
+        if (list.size() >= max_cache) {
+            if (!admission.admit(key, victim()->key)) {
+                ++nb_admission_rejected;
+                rejected = std::make_shared<const value_type>(key, std::move(value), cost, inflation + cost);
+                return *rejected;
+            }
+            // clean the cache by the end (where the entries are the
+            // older ones, or the cheapest ones) to make room for the new one
+            while (list.size() >= max_cache) {
+                const auto it = victim();
+                if (cost_aware) {
+                    inflation = it->priority;
+                }
+                if (keep_evicted) {
+                    evicted.push_back(*it);
+                }
+                list.erase(it);
+                ++nb_evictions;
+            }
+        }
+        const auto& res = *list.push_front(value_type(key, std::move(value), cost, inflation + cost)).first;
+        nb_entries = list.size();
+        return res;
+    }
+
+    bool expired(const value_type& entry) const {
+        return ttl != clock::duration::zero() && clock::now() - entry.created > ttl;
+    }
+
+    // replace the value of an entry, that is then fresh again
+    void replace(const key_type& key, mapped_type value) const {
+        auto& map = cache.template get<1>();
+        const auto search = map.find(key);
+        if (search == map.end()) {
+            return;
+        }
+        map.modify(search, [&](value_type& e) {
+            e.value = std::move(value);
+            e.created = clock::now();
+        });
+    }
+
+    // date back an entry whose value has been computed before being cached, if
+    // is_same(value of the entry) still holds
+    template <typename Pred>
+    void set_created(const key_type& key, clock::time_point created, Pred is_same) const {
+        auto& map = cache.template get<1>();
+        const auto search = map.find(key);
+        if (search == map.end() || !is_same(search->value)) {
+            return;
+        }
+        map.modify(search, [&](value_type& e) { e.created = created; });
+    }
+
+    // update the cost of an entry, when the value has not been computed by insert
+    void set_cost(const key_type& key, double cost) const {
+        auto& map = cache.template get<1>();
+        const auto search = map.find(key);
+        if (search == map.end()) {
+            return;
+        }
+        map.modify(search, [&](value_type& e) {
+            e.cost = cost;
+            e.priority = inflation + cost;
+        });
+        total_cost += cost;
+        ++nb_costs;
+    }
+
+    // count a call of the key like fetch, and return its entry if it is cached and
+    // fresh, or nullptr after counting a miss
+    const value_type* record_call(const key_type& key) const {
+        ++nb_calls;
+        admission.record(key);
+        if (const auto* entry = find(key)) {
+            if (!expired(*entry)) {
+                return entry;
+            }
+            cache.template get<1>().erase(key);
+            nb_entries = cache.size();
+        }
+        ++nb_cache_miss;
+        return nullptr;
+    }
+
+    // get the value of arg, computing and caching it if needed
+    // if stale is given, an expired entry is returned instead of being recomputed
+    const value_type& fetch(typename F::argument_type arg, bool* miss = nullptr, bool* stale = nullptr) const {
+        ++nb_calls;
+        admission.record(static_cast<const key_type&>(arg));
+        if (const auto* entry = find(arg)) {
+            if (!expired(*entry)) {
+                return *entry;
+            }
+            if (stale) {
+                *stale = true;
+                return *entry;
+            }
+            cache.template get<1>().erase(arg);
+            nb_entries = cache.size();
+        }
+        ++nb_cache_miss;
+        if (miss) {
+            *miss = true;
+        }
+        const auto start = clock::now();
+        auto value = f(arg);
+        const auto duration = clock::now() - start;
+        compute_histogram.record(duration);
+        if (deferred_cost) {
+            return insert(arg, std::move(value), mean_cost());
+        }
+        return insert(arg, std::move(value), std::chrono::duration<double, std::micro>(duration).count());
+    }
+
+    template <typename T, typename A>
     friend struct ConcurrentLru;
 
 public:
     using result_type = const mapped_type&;
     using argument_type = typename F::argument_type;
 
-    Lru(F fun, size_t max = 10) : f(std::move(fun)), max_cache(max) {
+    Lru(F fun, size_t max = 10, Admission adm = Admission())
+        : f(std::move(fun)), max_cache(max), admission(std::move(adm)) {
         if (max < 1) {
             throw std::invalid_argument("max (size of cache) must be strictly positive");
         }
     }
 
-    result_type operator()(argument_type arg) const {
-        ++nb_calls;
-        auto& list = cache.template get<0>();
-        auto& map = cache.template get<1>();
-        const auto search = map.find(arg);
-        if (search != map.end()) {
-            // put the cached value at the begining of the cache
-            list.relocate(list.begin(), cache.template project<0>(search));
-            return search->second;
-        } else {
-            ++nb_cache_miss;
-            // insert the new value at the begining of the cache
-            const auto ins = list.push_front(std::make_pair(arg, f(arg)));
-            // clean the cache by the end (where the entries are the
-            // older ones) until the requested size
-            while (list.size() > max_cache) {
-                list.pop_back();
-            }
-            return ins.first->second;
+    result_type operator()(argument_type arg) const { return fetch(arg).value; }
+
+    // get the values of several keys
+    std::vector<mapped_type> get_many(const std::vector<key_type>& args) const {
+        std::vector<mapped_type> result;
+        result.reserve(args.size());
+        for (const auto& arg : args) {
+            result.push_back(fetch(arg).value);
         }
+        return result;
+    }
+
+    // Evict the cheapest to recompute entries instead of the least recently used ones.
+    // Must be called before using the cache.
+    void enable_cost_aware_eviction() { cost_aware = true; }
+
+    // Expire the entries older than the given duration, zero to never expire them
+    void set_ttl(clock::duration duration) { ttl = duration; }
+
+    // remove all the cached values
+    void clear() {
+        cache.clear();
+        nb_entries = 0;
+    }
+
+    LruStats get_stats() const {
+        LruStats stats;
+        // fetch counts the call before the miss: read them in the reverse order, and clamp
+        // as the relaxed counters can still be seen out of order
+        stats.nb_misses = nb_cache_miss;
+        stats.nb_calls = nb_calls;
+        stats.nb_hits = stats.nb_calls > stats.nb_misses ? stats.nb_calls - stats.nb_misses : 0;
+        stats.nb_evictions = nb_evictions;
+        stats.nb_admission_rejected = nb_admission_rejected;
+        stats.size = nb_entries;
+        stats.max_size = max_cache;
+        stats.compute_histogram = compute_histogram.counts();
+        stats.compute_time = compute_histogram.total();
+        return stats;
     }
 
     size_t get_nb_cache_miss() const { return nb_cache_miss; }
     size_t get_nb_calls() const { return nb_calls; }
     size_t get_max_size() const { return max_cache; }
+    // number of computed values that have not been cached because of the admission policy
+    size_t get_nb_admission_rejected() const { return nb_admission_rejected; }
 };
 template <typename F>
 inline Lru<F> make_lru(F&& fun, size_t max = 10) {
     return Lru<F>(std::forward<F>(fun), max);
 }
+template <typename F, typename Admission>
+inline Lru<F, Admission> make_lru(F&& fun, size_t max, Admission admission) {
+    return Lru<F, Admission>(std::forward<F>(fun), max, std::move(admission));
+}
 
-template <typename F>
+template <typename F, typename Admission = NoAdmission>
 struct ConcurrentLru {
 private:
     struct SharedPtrF {
-        F f;
         using argument_type = typename F::argument_type;
-        using underlying_type =
-            typename boost::remove_cv<typename boost::remove_reference<typename F::result_type>::type>::type const;
+        using key_type = typename boost::remove_cv<typename boost::remove_reference<argument_type>::type>::type;
+        using value_type =
+            typename boost::remove_cv<typename boost::remove_reference<typename F::result_type>::type>::type;
+        using underlying_type = value_type const;
         using result_type = std::shared_future<std::shared_ptr<underlying_type>>;
+        using tier_type = SecondTier<key_type, value_type>;
+
+        // shared with the background refreshes, that can outlive a move of the cache
+        std::shared_ptr<const F> f;
+        std::shared_ptr<tier_type> tier;
+        std::shared_ptr<LatencyHistogram> histogram;
+        // the values of the second tier older than the ttl are not used
+        std::chrono::steady_clock::duration ttl = std::chrono::steady_clock::duration::zero();
+
+        // deleter of the values loaded from the second tier, keeping the
+        // time when they were computed and the value given by the tier
+        struct TierDeleter {
+            std::shared_ptr<underlying_type> owner;
+            typename tier_type::time_point computed;
+            void operator()(underlying_type*) {}
+        };
+
+        // the time when the value was computed, if it has been loaded from the second tier
+        static bool loaded_from_tier(const std::shared_ptr<underlying_type>& value,
+                                     typename tier_type::time_point& computed) {
+            if (const auto* deleter = std::get_deleter<TierDeleter>(value)) {
+                computed = deleter->computed;
+                return true;
+            }
+            return false;
+        }
+
+        // time spent by the current thread in compute, to tell apart the time spent
+        // running a deferred future from the time spent waiting for another thread
+        static std::chrono::steady_clock::duration& thread_compute_time() {
+            static thread_local std::chrono::steady_clock::duration duration{};
+            return duration;
+        }
+
+        static std::shared_ptr<underlying_type> compute(const F& f,
+                                                        tier_type* tier,
+                                                        std::chrono::steady_clock::duration ttl,
+                                                        LatencyHistogram& histogram,
+                                                        argument_type arg) {
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                auto value = load_or_compute(f, tier, ttl, histogram, arg);
+                thread_compute_time() += std::chrono::steady_clock::now() - start;
+                return value;
+            } catch (...) {
+                thread_compute_time() += std::chrono::steady_clock::now() - start;
+                throw;
+            }
+        }
+
+        // load the value from the second tier, or compute it
+        static std::shared_ptr<underlying_type> load_or_compute(const F& f,
+                                                                tier_type* tier,
+                                                                std::chrono::steady_clock::duration ttl,
+                                                                LatencyHistogram& histogram,
+                                                                argument_type arg) {
+            if (tier != nullptr) {
+                try {
+                    typename tier_type::time_point computed;
+                    auto value = tier->get(arg, computed);
+                    if (value
+                        && (ttl == std::chrono::steady_clock::duration::zero()
+                            || std::chrono::system_clock::now() - computed <= ttl)) {
+                        auto* p = value.get();
+                        return std::shared_ptr<underlying_type>(p, TierDeleter{std::move(value), computed});
+                    }
+                } catch (...) {
+                    // an unreadable record, left by a crash for instance: the value is computed
+                }
+            }
+            const auto start = std::chrono::steady_clock::now();
+            auto value = std::make_shared<underlying_type>(f(arg));
+            histogram.record(std::chrono::steady_clock::now() - start);
+            return value;
+        }
 
         result_type operator()(argument_type arg) const {
             // build a future that will be lazy initialized
-            return std::async(std::launch::deferred, [&]() { return std::make_shared<underlying_type>(f(arg)); })
+            return std::async(std::launch::deferred,
+                              [&]() { return compute(*f, tier.get(), ttl, *histogram, arg); })
                 .share();
         }
+
+        // a future owning its key, that can be computed after the caller is gone
+        result_type make_future(const key_type& key, std::launch policy, bool use_tier) const {
+            auto fun = f;
+            auto h = histogram;
+            auto t = use_tier ? tier : nullptr;
+            const auto d = ttl;
+            return std::async(policy, [fun, t, d, h, key]() { return compute(*fun, t.get(), d, *h, key); }).share();
+        }
     };
-    Lru<SharedPtrF> lru;
+
+public:
+    using key_type = typename SharedPtrF::key_type;
+    using tier_type = typename SharedPtrF::tier_type;
+
+private:
+    using future_type = typename SharedPtrF::result_type;
+
+    Lru<SharedPtrF, Admission> lru;
+    using evicted_type = decltype(lru.evicted);
     std::unique_ptr<std::mutex> mutex{std::make_unique<std::mutex>()};
 
-    std::vector<typename Lru<SharedPtrF>::key_type> keys() const {
+    // refresh ahead: the computations running in background for the stale entries,
+    // at most max_refreshes at a time
+    bool refresh_ahead = false;
+    size_t max_refreshes = 0;
+    mutable std::map<key_type, future_type> refreshing;
+    // the refreshes dropped by clear() while running, counted in max_refreshes
+    mutable std::vector<future_type> retired;
+    mutable RelaxedCounter nb_refresh;
+
+    using clock = std::chrono::steady_clock;
+    using value_ptr = std::shared_ptr<typename SharedPtrF::underlying_type>;
+
+    // Front cache: the last results got by a thread, kept in a thread
+    // local storage. A hit in the front cache touches no shared cache
+    // line: the returned shared_ptr shares the ownership of a thread
+    // local copy of the cached shared_ptr. The slots of an older epoch
+    // than the cache are invalid.
+    struct FrontCache {
+        struct Slot {
+            key_type key;
+            std::shared_ptr<value_ptr> value;
+            uint64_t epoch;
+            clock::time_point expiry;
+        };
+        std::vector<Slot> slots;
+        size_t max_slots = 0;
+        size_t next = 0;
+        // only written by the owner thread
+        std::atomic<size_t> nb_hits{0};
+
+        value_ptr find(const key_type& key, uint64_t epoch) {
+            for (const auto& slot : slots) {
+                if (slot.epoch != epoch || slot.key < key || key < slot.key) {
+                    continue;
+                }
+                if (slot.expiry != clock::time_point::max() && clock::now() > slot.expiry) {
+                    return nullptr;
+                }
+                nb_hits.store(nb_hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return value_ptr(slot.value, slot.value->get());
+            }
+            return nullptr;
+        }
+
+        void add(const key_type& key, const value_ptr& value, uint64_t epoch, clock::time_point expiry) {
+            for (auto& slot : slots) {
+                if (!(slot.key < key || key < slot.key)) {
+                    slot = {key, std::make_shared<value_ptr>(value), epoch, expiry};
+                    return;
+                }
+            }
+            if (slots.size() < max_slots) {
+                slots.push_back({key, std::make_shared<value_ptr>(value), epoch, expiry});
+                return;
+            }
+            slots[next] = {key, std::make_shared<value_ptr>(value), epoch, expiry};
+            next = (next + 1) % slots.size();
+        }
+    };
+    size_t front_cache_size = 0;
+    std::unique_ptr<std::atomic<uint64_t>> epoch{std::make_unique<std::atomic<uint64_t>>(0)};
+    // The front caches of the living threads. A front cache is owned by
+    // the thread local storage of its thread, and leaves the registry when
+    // its thread exits, keeping its hits in the count of the retired ones.
+    struct FrontRegistry {
+        std::mutex mutex;
+        std::vector<const FrontCache*> fronts;
+        size_t nb_retired_hits = 0;
+    };
+    // deleter of the front caches, unregistering them if their cache is still alive
+    struct Unregister {
+        std::weak_ptr<FrontRegistry> registry;
+        void operator()(FrontCache* front) const {
+            if (const auto r = registry.lock()) {
+                std::lock_guard<std::mutex> lock(r->mutex);
+                r->fronts.erase(std::find(r->fronts.begin(), r->fronts.end(), front));
+                r->nb_retired_hits += front->nb_hits.load(std::memory_order_relaxed);
+            }
+            delete front;
+        }
+    };
+    // identify the cache in the thread local storages, that are
+    // cleaned when the registry of their cache is destroyed
+    uint64_t id = next_id();
+    std::shared_ptr<FrontRegistry> front_registry{std::make_shared<FrontRegistry>()};
+
+    // time spent waiting for the lock, and for values computed by other threads
+    struct Waits {
+        std::atomic<uint64_t> lock_ns{0};
+        std::atomic<uint64_t> future_ns{0};
+    };
+    std::unique_ptr<Waits> waits{std::make_unique<Waits>()};
+
+    // take the lock, measuring the time spent waiting for it
+    std::unique_lock<std::mutex> timed_lock() const {
+        std::unique_lock<std::mutex> lock(*mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            const auto start = clock::now();
+            lock.lock();
+            const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+            waits->lock_ns.fetch_add(uint64_t(wait.count()), std::memory_order_relaxed);
+        }
+        return lock;
+    }
+
+    // progress of the current (or last) warmup
+    struct WarmupProgress {
+        std::atomic<size_t> nb_keys{0};
+        std::atomic<size_t> nb_warmed{0};
+    };
+    std::unique_ptr<WarmupProgress> warmup_progress{std::make_unique<WarmupProgress>()};
+
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    // the front cache of the current thread
+    FrontCache& front_cache() const {
+        struct Local {
+            uint64_t id;
+            std::weak_ptr<FrontRegistry> registry;
+            std::unique_ptr<FrontCache, Unregister> front;
+        };
+        static thread_local std::vector<Local> locals;
+        for (auto it = locals.begin(); it != locals.end();) {
+            if (it->id == id) {
+                return *it->front;
+            }
+            if (it->registry.expired()) {
+                it = locals.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        std::unique_ptr<FrontCache, Unregister> front(new FrontCache, Unregister{front_registry});
+        front->max_slots = front_cache_size;
+        {
+            std::lock_guard<std::mutex> lock(front_registry->mutex);
+            front_registry->fronts.push_back(front.get());
+        }
+        locals.push_back({id, front_registry, std::move(front)});
+        return *locals.back().front;
+    }
+
+    // Called with the lock: take the entries evicted since the last call
+    evicted_type take_evicted() const {
+        evicted_type res;
+        if (lru.keep_evicted) {
+            res.swap(lru.evicted);
+        }
+        return res;
+    }
+
+    // Called without the lock: store the evicted values in the second tier
+    void spill(const evicted_type& evicted) const {
+        for (const auto& elt : evicted) {
+            if (elt.value.wait_for(std::chrono::seconds(0)) != std::future_status::ready || lru.expired(elt)) {
+                continue;
+            }
+            // the age of the entry is converted to the wall clock of the second tier
+            using wall_duration = std::chrono::system_clock::duration;
+            const auto age = std::chrono::duration_cast<wall_duration>(clock::now() - elt.created);
+            try {
+                lru.f.tier->put(elt.key, *elt.value.get(), std::chrono::system_clock::now() - age);
+            } catch (...) {
+                // nothing to keep
+            }
+        }
+    }
+
+    // Called with the lock after a miss: with a ttl, a value loaded from the second tier
+    // is as old as its computation. Return the time when it expires.
+    clock::time_point date_back(const key_type& key, const value_ptr& value, clock::time_point expiry) const {
+        typename tier_type::time_point computed;
+        if (lru.ttl == clock::duration::zero() || !SharedPtrF::loaded_from_tier(value, computed)) {
+            return expiry;
+        }
+        const auto age = std::chrono::system_clock::now() - computed;
+        const auto created = clock::now() - std::chrono::duration_cast<clock::duration>(age);
+        lru.set_created(key, created, [&](const future_type& f) {
+            return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready && f.get() == value;
+        });
+        return std::min(expiry, created + lru.ttl);
+    }
+
+    // true if the value is ready and has been loaded from the second tier, and must be dated back
+    bool to_date_back(const future_type& future) const {
+        if (lru.ttl == clock::duration::zero()
+            || future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+        typename tier_type::time_point computed;
+        try {
+            return SharedPtrF::loaded_from_tier(future.get(), computed);
+        } catch (...) {
+            return false;
+        }
+    }
+
+    // Called with the lock: get the future of the value, and the time when it will expire
+    future_type lookup(typename SharedPtrF::argument_type arg, bool& miss, clock::time_point& expiry) const {
+        bool stale = false;
+        const auto& entry = lru.fetch(arg, &miss, refresh_ahead ? &stale : nullptr);
+        expiry = lru.ttl == clock::duration::zero() ? clock::time_point::max() : entry.created + lru.ttl;
+        if (stale) {
+            expiry = clock::time_point::min();
+            return refresh(arg, entry.value);
+        }
+        return entry.value;
+    }
+
+    // get the value from the shared cache, and the time when it will expire
+    value_ptr get(typename SharedPtrF::argument_type arg, clock::time_point& expiry) const {
+        future_type future;
+        bool miss = false;
+        evicted_type evicted;
+        {
+            const auto lock = timed_lock();
+            future = lookup(arg, miss, expiry);
+            evicted = take_evicted();
+        }
+        spill(evicted);
+        // As arg might be a reference, the maybe newly created future must be run
+        // before the end of the current method, else we can have a use after free.
+        if (!miss) {
+            if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                return future.get();
+            }
+            // the value is being computed by another thread, or is lazily computed by this
+            // one: the time spent computing it here is not a wait
+            const auto start = clock::now();
+            const auto computed_before = SharedPtrF::thread_compute_time();
+            auto result = future.get();
+            const auto computed_here = SharedPtrF::thread_compute_time() - computed_before;
+            const auto wait =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start - computed_here);
+            if (wait.count() > 0) {
+                waits->future_ns.fetch_add(uint64_t(wait.count()), std::memory_order_relaxed);
+            }
+            return result;
+        }
+        // the future is lazy, the cost of the entry is the time needed to get it
+        const auto start = clock::now();
+        auto result = future.get();
+        const std::chrono::duration<double, std::micro> cost = clock::now() - start;
+        if (lru.cost_aware || to_date_back(future)) {
+            const auto lock = timed_lock();
+            if (lru.cost_aware) {
+                lru.set_cost(arg, cost.count());
+            }
+            expiry = date_back(arg, result, expiry);
+        }
+        return result;
+    }
+
+    // Called with the lock on a stale entry: start its computation in
+    // background, or install it in the cache if it is finished. Until
+    // then, the stale value is used.
+    future_type refresh(const key_type& key, const future_type& stale) const {
+        const auto search = refreshing.find(key);
+        if (search == refreshing.end()) {
+            if (refreshing.size() + retired.size() >= max_refreshes) {
+                clean_refreshing();
+                if (refreshing.size() + retired.size() >= max_refreshes) {
+                    // too many refreshes: the stale value is served until one of them ends
+                    return stale;
+                }
+            }
+            // the second tier could only give back the stale value
+            refreshing[key] = lru.f.make_future(key, std::launch::async, false);
+            ++nb_refresh;
+            return stale;
+        }
+        if (search->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return stale;
+        }
+        auto fresh = std::move(search->second);
+        refreshing.erase(search);
+        try {
+            fresh.get();
+        } catch (...) {
+            // stale if error: the next call will try again
+            return stale;
+        }
+        lru.replace(key, fresh);
+        return fresh;
+    }
+
+    // install the finished refreshes, forgetting the ones of the evicted entries
+    // and the finished retired ones
+    void clean_refreshing() const {
+        retired.erase(std::remove_if(retired.begin(), retired.end(),
+                                     [](const future_type& f) {
+                                         return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+                                     }),
+                      retired.end());
+        for (auto it = refreshing.begin(); it != refreshing.end();) {
+            if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                ++it;
+                continue;
+            }
+            try {
+                it->second.get();
+                lru.replace(it->first, it->second);
+            } catch (...) {
+            }
+            it = refreshing.erase(it);
+        }
+    }
+
+    std::vector<key_type> keys() const {
         std::lock_guard<std::mutex> lock(*mutex);
         return lru.keys();
     }
@@ -158,18 +828,167 @@ public:
     using result_type = typename std::shared_ptr<typename SharedPtrF::underlying_type>;
     using argument_type = typename SharedPtrF::argument_type;
 
-    ConcurrentLru(F fun, size_t max = 10) : lru(SharedPtrF{std::move(fun)}, max) {}
+    ConcurrentLru(F fun, size_t max = 10, Admission admission = Admission())
+        : lru(SharedPtrF{std::make_shared<const F>(std::move(fun)), nullptr, std::make_shared<LatencyHistogram>()},
+              max,
+              std::move(admission)) {}
     ConcurrentLru(ConcurrentLru&&) = default;  // NOLINT // needed by old version of gcc
 
     result_type operator()(argument_type arg) const {
-        typename SharedPtrF::result_type future;
+        clock::time_point expiry;
+        if (front_cache_size == 0) {
+            return get(arg, expiry);
+        }
+        auto& front = front_cache();
+        const auto current_epoch = epoch->load(std::memory_order_acquire);
+        if (auto result = front.find(arg, current_epoch)) {
+            return result;
+        }
+        auto result = get(arg, expiry);
+        front.add(arg, result, current_epoch, expiry);
+        return result;
+    }
+
+    // Get the values of several keys, taking the lock only once for all of them.
+    // The missing values are computed by nb_threads threads, including the calling one.
+    // The front cache is not used.
+    std::vector<result_type> get_many(const std::vector<key_type>& args, size_t nb_threads = 1) const {
+        std::vector<future_type> futures;
+        futures.reserve(args.size());
+        std::vector<size_t> misses;
+        evicted_type evicted;
+        {
+            const auto lock = timed_lock();
+            clock::time_point expiry;
+            for (size_t i = 0; i < args.size(); ++i) {
+                bool miss = false;
+                futures.push_back(lookup(args[i], miss, expiry));
+                if (miss) {
+                    misses.push_back(i);
+                }
+            }
+            evicted = take_evicted();
+        }
+        spill(evicted);
+
+        // the futures are lazy, we compute the misses in parallel
+        std::vector<double> costs(misses.size(), 0);
+        std::atomic<size_t> next{0};
+        auto compute = [&]() {
+            for (size_t i = next++; i < misses.size(); i = next++) {
+                const auto start = clock::now();
+                try {
+                    futures[misses[i]].get();
+                } catch (...) {
+                    // the exception is stored in the future and raised below
+                }
+                costs[i] = std::chrono::duration<double, std::micro>(clock::now() - start).count();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(nb_threads, misses.size()); ++i) {
+            workers.emplace_back(compute);
+        }
+        compute();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        std::vector<size_t> loaded;
+        for (const auto i : misses) {
+            if (to_date_back(futures[i])) {
+                loaded.push_back(i);
+            }
+        }
+        if ((lru.cost_aware && !misses.empty()) || !loaded.empty()) {
+            const auto lock = timed_lock();
+            if (lru.cost_aware) {
+                for (size_t i = 0; i < misses.size(); ++i) {
+                    lru.set_cost(args[misses[i]], costs[i]);
+                }
+            }
+            for (const auto i : loaded) {
+                date_back(args[i], futures[i].get(), clock::time_point::max());
+            }
+        }
+
+        std::vector<result_type> result;
+        result.reserve(futures.size());
+        for (const auto& future : futures) {
+            result.push_back(future.get());
+        }
+        return result;
+    }
+
+    // Keep the last nb_entries results got by each thread in a thread
+    // local front cache. Those hits are not counted by get_nb_calls.
+    // Must be called before using the cache.
+    void enable_front_cache(size_t nb_entries) { front_cache_size = nb_entries; }
+
+    // invalidate the front caches of all the threads
+    void invalidate_front_caches() { epoch->fetch_add(1, std::memory_order_release); }
+
+    // Keep the evicted values in a second tier, checked on a miss before
+    // computing the value. The values are written in the second tier
+    // without the lock, by the thread causing their eviction.
+    // Must be called before using the cache.
+    void set_second_tier(std::shared_ptr<tier_type> tier) {
+        std::lock_guard<std::mutex> lock(*mutex);
+        lru.keep_evicted = tier != nullptr;
+        lru.f.tier = std::move(tier);
+    }
+
+    // Remove all the cached values, including the ones of the second tier
+    // and the background refreshes, that are computed from the old data.
+    // The running refreshes are not waited for, their results are dropped.
+    void clear() {
         {
             std::lock_guard<std::mutex> lock(*mutex);
-            future = lru(arg);
+            lru.clear();
+            lru.evicted.clear();
+            for (auto& elt : refreshing) {
+                if (elt.second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    retired.push_back(std::move(elt.second));
+                }
+            }
+            refreshing.clear();
+            if (lru.f.tier) {
+                lru.f.tier->clear();
+            }
         }
-        // As arg might be a reference, the maybe newly created future must be run
-        // before the end of the current method, else we can have a use after free.
-        return future.get();
+        invalidate_front_caches();
+    }
+
+    // Evict the cheapest to recompute entries instead of the least recently used ones.
+    // Must be called before using the cache.
+    void enable_cost_aware_eviction() {
+        std::lock_guard<std::mutex> lock(*mutex);
+        lru.enable_cost_aware_eviction();
+        lru.deferred_cost = true;
+    }
+
+    // Expire the entries older than the given duration, zero to never expire them
+    void set_ttl(std::chrono::steady_clock::duration ttl) {
+        std::lock_guard<std::mutex> lock(*mutex);
+        lru.set_ttl(ttl);
+        lru.f.ttl = ttl;
+    }
+
+    // Stale while revalidate: an expired entry is still returned while
+    // its new value is computed by a background thread, only one
+    // computation being run by key. The callers never wait for a refresh.
+    // At most max_refreshes threads are started at a time, the other stale
+    // entries are served as is until then. The destruction of the cache
+    // waits for the running refreshes, at most max_refreshes computations
+    // of f, as f may use data owned by the caller: a slow f delays it.
+    // clear() does not wait for them.
+    void enable_refresh_ahead(size_t max_refreshes = 4) {
+        if (max_refreshes == 0) {
+            throw std::invalid_argument("max_refreshes must be strictly positive");
+        }
+        std::lock_guard<std::mutex> lock(*mutex);
+        refresh_ahead = true;
+        this->max_refreshes = max_refreshes;
     }
 
     // We add mutex lock in all get_nb_** functions :
@@ -189,18 +1008,155 @@ public:
         std::lock_guard<std::mutex> lock(*mutex);
         return lru.get_max_size();
     }
+    size_t get_nb_admission_rejected() const {
+        std::lock_guard<std::mutex> lock(*mutex);
+        return lru.get_nb_admission_rejected();
+    }
+    // number of background refreshes started
+    size_t get_nb_refresh() const { return nb_refresh; }
+    // number of hits in the front caches of all the threads
+    size_t get_nb_front_cache_hits() const {
+        std::lock_guard<std::mutex> lock(front_registry->mutex);
+        size_t res = front_registry->nb_retired_hits;
+        for (const auto* front : front_registry->fronts) {
+            res += front->nb_hits.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+
+    // Snapshot of the counters, taken without the lock of the cache
+    LruStats get_stats() const {
+        auto stats = lru.get_stats();
+        stats.nb_front_cache_hits = get_nb_front_cache_hits();
+        stats.nb_refresh = nb_refresh;
+        stats.compute_histogram = lru.f.histogram->counts();
+        stats.compute_time = lru.f.histogram->total();
+        stats.future_wait_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::nanoseconds(waits->future_ns.load(std::memory_order_relaxed)));
+        stats.lock_wait_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::nanoseconds(waits->lock_ns.load(std::memory_order_relaxed)));
+        return stats;
+    }
+
+    // progress of the current warmup, or result of the last one without the elapsed time
+    WarmupStats get_warmup_progress() const {
+        WarmupStats stats;
+        stats.nb_keys = warmup_progress->nb_keys.load();
+        stats.nb_warmed = warmup_progress->nb_warmed.load();
+        return stats;
+    }
 
-    void warmup(const ConcurrentLru<F>& other) {
-        // we can't use the warmup of the lru direclty as it will mess with the future
-        auto keys = other.keys();
-        for (const auto& key : boost::adaptors::reverse(keys)) {
-            this->operator()(key);
+    // Cache the given keys, ordered from the most recently used, and compute
+    // their values with the given threads and time budget.
+    WarmupStats warmup(std::vector<key_type> keys, const WarmupOptions& options = WarmupOptions()) {
+        const auto start = clock::now();
+        if (keys.size() > lru.max_cache) {
+            keys.erase(keys.begin() + lru.max_cache, keys.end());
+        }
+        warmup_progress->nb_keys = keys.size();
+        warmup_progress->nb_warmed = 0;
+
+        // we can't use the operator() as the futures can be computed after the end of the warmup
+        std::vector<future_type> futures(keys.size());
+        // the cost of the inserted entries, negative for the other ones
+        std::vector<double> costs(keys.size(), -1);
+        evicted_type evicted;
+        {
+            std::lock_guard<std::mutex> lock(*mutex);
+            // from the least recently used to keep the order of the keys, each key
+            // being counted as a call, seen by the admission policy
+            for (size_t i = keys.size(); i-- > 0;) {
+                if (const auto* entry = lru.record_call(keys[i])) {
+                    futures[i] = entry->value;
+                } else {
+                    auto future = lru.f.make_future(keys[i], std::launch::deferred, true);
+                    futures[i] = lru.insert(keys[i], std::move(future), lru.mean_cost()).value;
+                    costs[i] = 0;
+                }
+            }
+            evicted = take_evicted();
+        }
+        spill(evicted);
+
+        // the most recently used are computed first
+        const auto deadline = start + options.time_budget;
+        std::atomic<size_t> next{0};
+        auto compute = [&]() {
+            for (size_t i = next++; i < futures.size(); i = next++) {
+                if (options.time_budget != std::chrono::milliseconds::zero() && clock::now() > deadline) {
+                    return;
+                }
+                const auto begin = clock::now();
+                try {
+                    futures[i].get();
+                } catch (...) {
+                    // the error will be raised to the callers of this key
+                }
+                if (costs[i] == 0) {
+                    costs[i] = std::chrono::duration<double, std::micro>(clock::now() - begin).count();
+                }
+                ++warmup_progress->nb_warmed;
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(options.nb_threads, futures.size()); ++i) {
+            workers.emplace_back(compute);
         }
+        compute();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        std::vector<size_t> loaded;
+        for (size_t i = 0; i < futures.size(); ++i) {
+            if (to_date_back(futures[i])) {
+                loaded.push_back(i);
+            }
+        }
+        if (lru.cost_aware || !loaded.empty()) {
+            std::lock_guard<std::mutex> lock(*mutex);
+            // the entries not computed in time keep the mean cost
+            for (size_t i = 0; lru.cost_aware && i < keys.size(); ++i) {
+                if (costs[i] > 0) {
+                    lru.set_cost(keys[i], costs[i]);
+                }
+            }
+            for (const auto i : loaded) {
+                date_back(keys[i], futures[i].get(), clock::time_point::max());
+            }
+        }
+        invalidate_front_caches();
+
+        auto stats = get_warmup_progress();
+        stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+        return stats;
+    }
+
+    WarmupStats warmup(const ConcurrentLru& other, const WarmupOptions& options = WarmupOptions()) {
+        return warmup(other.keys(), options);
+    }
+
+    // Save the cached keys, from the most recently used, in a boost archive
+    // to warmup another cache with warmup_from_keys, after a restart for example
+    template <class Archive>
+    void save_keys(Archive& ar) const {
+        const auto k = keys();
+        ar << k;
+    }
+
+    template <class Archive>
+    WarmupStats warmup_from_keys(Archive& ar, const WarmupOptions& options = WarmupOptions()) {
+        std::vector<key_type> k;
+        ar >> k;
+        return warmup(std::move(k), options);
     }
 };
 template <typename F>
 inline ConcurrentLru<F> make_concurrent_lru(F&& fun, size_t max = 10) {
     return ConcurrentLru<F>(std::forward<F>(fun), max);
 }
+template <typename F, typename Admission>
+inline ConcurrentLru<F, Admission> make_concurrent_lru(F&& fun, size_t max, Admission admission) {
+    return ConcurrentLru<F, Admission>(std::forward<F>(fun), max, std::move(admission));
+}
 
 }  // namespace navitia
@@ -0,0 +1,158 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#include "utils/mmap_idx_map.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace navitia {
+
+MmapIdxMapError::~MmapIdxMapError() noexcept = default;
+
+namespace mmap_idx_map {
+
+namespace {
+
+constexpr char magic[8] = {'N', 'A', 'V', 'I', 'D', 'X', 'M', 'P'};
+
+std::string error_message(const std::string& msg, const std::string& path) {
+    return msg + " " + path + ": " + std::strerror(errno);
+}
+
+void write_all(int fd, const char* data, size_t size, const std::string& path) {
+    while (size > 0) {
+        const auto written = ::write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw MmapIdxMapError(error_message("impossible to write in", path));
+        }
+        data += written;
+        size -= size_t(written);
+    }
+}
+
+}  // namespace
+
+void write(const std::string& path, const void* data, size_t type_size, size_t type_alignment, size_t nb_elements) {
+    if (type_alignment > data_offset) {
+        throw MmapIdxMapError("impossible to write " + path + ": the alignment of the values is too large");
+    }
+    const auto tmp_path = path + ".tmp";
+    const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw MmapIdxMapError(error_message("impossible to open", tmp_path));
+    }
+    try {
+        char header[data_offset] = {};
+        Header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.type_size = uint32_t(type_size);
+        h.type_alignment = uint32_t(type_alignment);
+        h.data_offset = data_offset;
+        h.nb_elements = nb_elements;
+        std::memcpy(header, &h, sizeof(h));
+        write_all(fd, header, sizeof(header), tmp_path);
+        write_all(fd, static_cast<const char*>(data), type_size * nb_elements, tmp_path);
+        if (::fsync(fd) != 0) {
+            throw MmapIdxMapError(error_message("impossible to sync", tmp_path));
+        }
+    } catch (...) {
+        ::close(fd);
+        std::remove(tmp_path.c_str());
+        throw;
+    }
+    ::close(fd);
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw MmapIdxMapError(error_message("impossible to rename to", path));
+    }
+}
+
+MappedFile::MappedFile(const std::string& path, size_t type_size, size_t type_alignment) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw MmapIdxMapError(error_message("impossible to open", path));
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw MmapIdxMapError(error_message("impossible to stat", path));
+    }
+    map_size = size_t(st.st_size);
+    if (map_size < data_offset) {
+        ::close(fd);
+        throw MmapIdxMapError(path + " is not a MmapIdxMap: the file is too small");
+    }
+    void* addr = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid after closing the file
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        throw MmapIdxMapError(error_message("impossible to map", path));
+    }
+    map = static_cast<const char*>(addr);
+
+    Header h{};
+    std::memcpy(&h, map, sizeof(h));
+    std::string error;
+    if (std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+        error = "wrong magic number";
+    } else if (h.version != version) {
+        error = "version " + std::to_string(h.version) + " instead of " + std::to_string(version);
+    } else if (h.type_size != type_size) {
+        error = "values of " + std::to_string(h.type_size) + " bytes instead of " + std::to_string(type_size);
+    } else if (h.type_alignment != type_alignment || h.data_offset != data_offset) {
+        error = "wrong alignment of the values";
+    } else if (h.nb_elements > (map_size - data_offset) / type_size) {
+        error = "the file is truncated";
+    }
+    if (!error.empty()) {
+        ::munmap(const_cast<char*>(map), map_size);
+        throw MmapIdxMapError("impossible to load " + path + ": " + error);
+    }
+    nb = size_t(h.nb_elements);
+}
+
+MappedFile::~MappedFile() {
+    ::munmap(const_cast<char*>(map), map_size);
+}
+
+}  // namespace mmap_idx_map
+
+}  // namespace navitia
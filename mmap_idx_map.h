@@ -0,0 +1,154 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/exception.h"
+#include "utils/idx_map.h"
+
+#include <boost/range/iterator_range_core.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+namespace navitia {
+
+class MmapIdxMapError : public exception {
+    using exception::exception;
+
+public:
+    MmapIdxMapError(const MmapIdxMapError&) = default;
+    ~MmapIdxMapError() noexcept override;
+};
+
+namespace mmap_idx_map {
+
+// Layout of the file:
+// - the header, padded to data_offset bytes
+// - the values, as they are in memory
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t type_size;
+    uint32_t type_alignment;
+    uint32_t data_offset;
+    uint64_t nb_elements;
+};
+
+constexpr uint32_t version = 1;
+// the values are aligned on a cache line
+constexpr uint32_t data_offset = 64;
+static_assert(sizeof(Header) <= data_offset, "the header must fit before the values");
+
+// write the header and the values to path, through a temporary file renamed at the end
+void write(const std::string& path, const void* data, size_t type_size, size_t type_alignment, size_t nb_elements);
+
+// Read only mapping of a whole file, checking its header
+class MappedFile {
+public:
+    MappedFile(const std::string& path, size_t type_size, size_t type_alignment);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const void* data() const { return map + data_offset; }
+    size_t nb_elements() const { return nb; }
+
+private:
+    const char* map = nullptr;
+    size_t map_size = 0;
+    size_t nb = 0;
+};
+
+}  // namespace mmap_idx_map
+
+// Dump the values of an IdxMap, to be loaded by a MmapIdxMap
+template <typename T, typename V>
+void write_mmap_idx_map(const std::string& path, const IdxMap<T, V>& map) {
+    static_assert(std::is_trivially_copyable<V>::value, "the values of a MmapIdxMap must be trivially copyable");
+    const V* data = map.size() == 0 ? nullptr : &*map.values().begin();
+    mmap_idx_map::write(path, data, sizeof(V), alignof(V), map.size());
+}
+
+/*
+ * Read only IdxMap whose values are in a memory mapped file
+ *
+ * The file is written by write_mmap_idx_map, with a header checked when
+ * the file is mapped: the values are not deserialized, so loading the
+ * map does not depend on its size, and the processes mapping the same
+ * file share the same pages.
+ *
+ * The file must not be modified while it is mapped: write_mmap_idx_map
+ * replaces it by a new file. The copies of a MmapIdxMap share the same
+ * mapping.
+ */
+template <typename T, typename V>
+struct MmapIdxMap {
+    static_assert(std::is_trivially_copyable<V>::value, "the values of a MmapIdxMap must be trivially copyable");
+
+    using key_type = Idx<T>;
+    using mapped_type = V;
+    using const_iterator = IdxMapIterator<key_type, const V*>;
+    using iterator = const_iterator;
+    using const_range = boost::iterator_range<const V*>;
+
+    inline MmapIdxMap() = default;
+    inline explicit MmapIdxMap(const std::string& path)
+        : file(std::make_shared<const mmap_idx_map::MappedFile>(path, sizeof(V), alignof(V))),
+          data(static_cast<const V*>(file->data())),
+          nb(file->nb_elements()) {}
+
+    // accessors
+    inline size_t size() const { return nb; }
+    inline const V& operator[](const Idx<T>& idx) const { return data[idx.val]; }
+    inline const V& at(const Idx<T>& idx) const {
+        if (idx.val >= nb) {
+            throw std::out_of_range("MmapIdxMap::at");
+        }
+        return data[idx.val];
+    }
+
+    // iterator getters
+    inline const_iterator begin() const { return const_iterator(0, data); }
+    inline const_iterator end() const { return const_iterator(idx_t(nb), data + nb); }
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
+
+    // iterate on const values
+    inline const_range values() const { return boost::make_iterator_range(data, data + nb); }
+
+private:
+    std::shared_ptr<const mmap_idx_map::MappedFile> file;
+    const V* data = nullptr;
+    size_t nb = 0;
+};
+
+}  // namespace navitia
@@ -0,0 +1,318 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#include "utils/mmap_store.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+namespace navitia {
+
+namespace {
+
+struct RecordHeader {
+    uint32_t key_size;
+    uint32_t value_size;
+};
+
+// start of the file, followed by the format of the store
+constexpr char magic[8] = {'N', 'A', 'V', 'M', 'M', 'S', 'T', '1'};
+
+std::string file_header(const std::string& format) {
+    const auto format_size = uint32_t(format.size());
+    std::string header(magic, sizeof(magic));
+    header.append(reinterpret_cast<const char*>(&format_size), sizeof(format_size));
+    header.append(format);
+    return header;
+}
+
+size_t record_size(size_t key_size, size_t value_size) {
+    return sizeof(RecordHeader) + key_size + value_size;
+}
+
+std::string error_message(const std::string& msg, const std::string& path) {
+    return msg + " " + path + ": " + std::strerror(errno);
+}
+
+void write_all(int fd, const char* data, size_t size, size_t offset, const std::string& path) {
+    while (size > 0) {
+        const auto written = ::pwrite(fd, data, size, off_t(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw MmapStoreError(error_message("impossible to write in", path));
+        }
+        data += written;
+        size -= size_t(written);
+        offset += size_t(written);
+    }
+}
+
+// close a temporary file, and remove it unless it has been kept
+struct TmpFileGuard {
+    int fd;
+    const std::string& path;
+    bool kept = false;
+    ~TmpFileGuard() {
+        close();
+        if (!kept) {
+            ::unlink(path.c_str());
+        }
+    }
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+}  // namespace
+
+MmapStoreError::~MmapStoreError() noexcept = default;
+
+MmapStore::MmapStore(std::string p, size_t max, const std::string& format)
+    : path(std::move(p)), max_size(max), header(file_header(format)) {
+    open();
+    load_index();
+}
+
+MmapStore::~MmapStore() {
+    close();
+}
+
+void MmapStore::open() {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        throw MmapStoreError(error_message("impossible to open", path));
+    }
+}
+
+void MmapStore::close() {
+    if (map != nullptr) {
+        ::munmap(const_cast<char*>(map), map_size);
+        map = nullptr;
+        map_size = 0;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// Map the file up to its maximum size, so that the appended records are
+// readable without mapping it again. The pages after the end of the file
+// are never read. Must be called with the lock.
+void MmapStore::remap() {
+    if (map != nullptr) {
+        ::munmap(const_cast<char*>(map), map_size);
+        map = nullptr;
+        map_size = 0;
+    }
+    const size_t size = std::max({max_size, end, header.size()});
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (addr == MAP_FAILED) {
+        throw MmapStoreError(error_message("impossible to map", path));
+    }
+    map = static_cast<const char*>(addr);
+    map_size = size;
+}
+
+// truncate the file to its header, must be called with the lock
+void MmapStore::reset() {
+    index.clear();
+    if (::ftruncate(fd, 0) != 0) {
+        throw MmapStoreError(error_message("impossible to truncate", path));
+    }
+    write_all(fd, header.data(), header.size(), 0, path);
+    end = header.size();
+}
+
+// Read the records already in the file, and drop a truncated last record.
+// A file of another format is emptied.
+void MmapStore::load_index() {
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        throw MmapStoreError(error_message("impossible to stat", path));
+    }
+    end = size_t(st.st_size);
+    remap();
+    if (end < header.size() || header.compare(0, header.size(), map, header.size()) != 0) {
+        reset();
+        return;
+    }
+    size_t offset = header.size();
+    while (offset + sizeof(RecordHeader) <= end) {
+        RecordHeader header{};
+        std::memcpy(&header, map + offset, sizeof(header));
+        const auto size = record_size(header.key_size, header.value_size);
+        if (offset + size > end) {
+            break;
+        }
+        index[std::string(map + offset + sizeof(header), header.key_size)] = {offset, header.key_size,
+                                                                              header.value_size};
+        offset += size;
+    }
+    if (offset != end) {
+        if (::ftruncate(fd, off_t(offset)) != 0) {
+            throw MmapStoreError(error_message("impossible to truncate", path));
+        }
+        end = offset;
+    }
+}
+
+bool MmapStore::get(const std::string& key, std::string& value) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto search = index.find(key);
+    if (search == index.end()) {
+        ++nb_misses;
+        return false;
+    }
+    const auto& location = search->second;
+    value.assign(map + location.offset + sizeof(RecordHeader) + location.key_size, location.value_size);
+    ++nb_hits;
+    return true;
+}
+
+void MmapStore::append(const std::string& key, const std::string& value) {
+    const RecordHeader header{uint32_t(key.size()), uint32_t(value.size())};
+    std::string record;
+    record.reserve(record_size(key.size(), value.size()));
+    record.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    record.append(key);
+    record.append(value);
+    write_all(fd, record.data(), record.size(), end, path);
+    index[key] = {end, header.key_size, header.value_size};
+    end += record.size();
+}
+
+void MmapStore::put(const std::string& key, const std::string& value) {
+    const auto size = record_size(key.size(), value.size());
+    if (header.size() + size > max_size || key.size() > UINT32_MAX || value.size() > UINT32_MAX) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (end + size > max_size) {
+        const size_t budget = max_size / 2 > header.size() + size ? max_size / 2 - header.size() - size : 0;
+        compact(budget);
+    }
+    append(key, value);
+}
+
+void MmapStore::compact() {
+    std::lock_guard<std::mutex> lock(mutex);
+    compact(max_size);
+}
+
+// rewrite the last records of each key, from the most recent, up to target_size
+// must be called with the lock
+void MmapStore::compact(size_t target_size) {
+    std::vector<std::pair<const std::string*, Location>> records;
+    records.reserve(index.size());
+    for (const auto& elt : index) {
+        records.emplace_back(&elt.first, elt.second);
+    }
+    std::sort(records.begin(), records.end(),
+              [](const std::pair<const std::string*, Location>& a, const std::pair<const std::string*, Location>& b) {
+                  return a.second.offset > b.second.offset;
+              });
+    size_t kept_size = 0;
+    size_t nb_kept = 0;
+    for (const auto& record : records) {
+        const auto size = record_size(record.second.key_size, record.second.value_size);
+        if (kept_size + size > target_size) {
+            break;
+        }
+        kept_size += size;
+        ++nb_kept;
+    }
+
+    // the kept records are written in a new file, in their previous order
+    const std::string tmp_path = path + ".tmp";
+    TmpFileGuard tmp{::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644), tmp_path};
+    if (tmp.fd < 0) {
+        throw MmapStoreError(error_message("impossible to open", tmp_path));
+    }
+    write_all(tmp.fd, header.data(), header.size(), 0, tmp_path);
+    std::unordered_map<std::string, Location> new_index;
+    size_t offset = header.size();
+    for (size_t i = nb_kept; i-- > 0;) {
+        const auto& location = records[i].second;
+        const auto size = record_size(location.key_size, location.value_size);
+        write_all(tmp.fd, map + location.offset, size, offset, tmp_path);
+        new_index[*records[i].first] = {offset, location.key_size, location.value_size};
+        offset += size;
+    }
+    tmp.close();
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        throw MmapStoreError(error_message("impossible to rename", tmp_path));
+    }
+    tmp.kept = true;
+    close();
+    open();
+    index = std::move(new_index);
+    end = offset;
+    remap();
+}
+
+void MmapStore::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    reset();
+}
+
+size_t MmapStore::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+size_t MmapStore::file_size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return end;
+}
+
+size_t MmapStore::get_nb_hits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nb_hits;
+}
+
+size_t MmapStore::get_nb_misses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return nb_misses;
+}
+
+}  // namespace navitia
@@ -0,0 +1,193 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/exception.h"
+#include "utils/lru.h"
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace navitia {
+
+class MmapStoreError : public exception {
+    using exception::exception;
+
+public:
+    MmapStoreError(const MmapStoreError&) = default;
+    ~MmapStoreError() noexcept override;
+};
+
+/*
+ * Local key/value store on disk
+ *
+ * The records are appended to a file, read through a memory mapping of
+ * the file. The index of the records is kept in memory and is rebuilt
+ * from the file when the store is opened, so the content of the store
+ * survives a restart.
+ *
+ * When the file would exceed max_size, it is compacted: only the last
+ * record of each key is kept, and the oldest ones are dropped until
+ * the file is at most half of max_size. The file is mapped once over
+ * max_size, without reserving the memory.
+ *
+ * The file starts with the format given by the user, a file of another
+ * format is emptied when it is opened: the format must be changed with
+ * the encoding of the records.
+ *
+ * The store can be used by several threads.
+ */
+class MmapStore {
+public:
+    MmapStore(std::string path, size_t max_size, const std::string& format = "");
+    ~MmapStore();
+    MmapStore(const MmapStore&) = delete;
+    MmapStore& operator=(const MmapStore&) = delete;
+
+    // return false if the key is not in the store
+    bool get(const std::string& key, std::string& value) const;
+    void put(const std::string& key, const std::string& value);
+    void clear();
+    void compact();
+
+    size_t size() const;
+    size_t file_size() const;
+    size_t get_nb_hits() const;
+    size_t get_nb_misses() const;
+
+private:
+    struct Location {
+        size_t offset;  // of the record
+        uint32_t key_size;
+        uint32_t value_size;
+    };
+
+    const std::string path;
+    const size_t max_size;
+    // magic number and format, at the start of the file
+    const std::string header;
+    int fd = -1;
+    // end of the last record, the file is always written up to there
+    size_t end = 0;
+    const char* map = nullptr;
+    size_t map_size = 0;
+    std::unordered_map<std::string, Location> index;
+    mutable size_t nb_hits = 0;
+    mutable size_t nb_misses = 0;
+    mutable std::mutex mutex;
+
+    void open();
+    void close();
+    void load_index();
+    void remap();
+    void reset();
+    void append(const std::string& key, const std::string& value);
+    void compact(size_t target_size);
+};
+
+// Serialization of the keys and values of a MmapTier with boost binary archives
+template <typename T>
+struct BoostBinarySerializer {
+    static std::string save(const T& t) {
+        std::ostringstream os;
+        boost::archive::binary_oarchive oa(os, boost::archive::no_header);
+        oa << t;
+        return os.str();
+    }
+    static T load(const std::string& bytes) {
+        std::istringstream is(bytes);
+        boost::archive::binary_iarchive ia(is, boost::archive::no_header);
+        T t;
+        ia >> t;
+        return t;
+    }
+};
+
+/*
+ * Second tier of a ConcurrentLru, keeping the evicted values in a MmapStore.
+ *
+ * The serializers must provide `static std::string save(const T&)` and
+ * `static T load(const std::string&)`. Each record starts with the time
+ * when its value was computed, followed by the serialized value.
+ *
+ * The format of the store is made of the key and value types, and of
+ * the given version, to change with the serialization of the values:
+ * the records of an older format are dropped.
+ */
+template <typename Key,
+          typename Value,
+          typename KeySerializer = BoostBinarySerializer<Key>,
+          typename ValueSerializer = BoostBinarySerializer<Value>>
+class MmapTier : public SecondTier<Key, Value> {
+public:
+    MmapTier(const std::string& path, size_t max_size, const std::string& version = "")
+        : store(path,
+                max_size,
+                std::string("MmapTier 1 ") + typeid(Key).name() + " " + typeid(Value).name() + " " + version) {}
+
+    using time_point = typename SecondTier<Key, Value>::time_point;
+
+    std::shared_ptr<const Value> get(const Key& key, time_point& computed) override {
+        std::string bytes;
+        if (!store.get(KeySerializer::save(key), bytes)) {
+            return nullptr;
+        }
+        int64_t ticks = 0;
+        if (bytes.size() < sizeof(ticks)) {
+            throw MmapStoreError("MmapTier: truncated record");
+        }
+        std::memcpy(&ticks, bytes.data(), sizeof(ticks));
+        computed = time_point(typename time_point::duration(ticks));
+        return std::make_shared<const Value>(ValueSerializer::load(bytes.substr(sizeof(ticks))));
+    }
+    void put(const Key& key, const Value& value, time_point computed) override {
+        const int64_t ticks = computed.time_since_epoch().count();
+        std::string bytes(sizeof(ticks), '\0');
+        std::memcpy(&bytes[0], &ticks, sizeof(ticks));
+        bytes += ValueSerializer::save(value);
+        store.put(KeySerializer::save(key), bytes);
+    }
+    void clear() override { store.clear(); }
+
+    const MmapStore& get_store() const { return store; }
+
+private:
+    MmapStore store;
+};
+
+}  // namespace navitia
@@ -30,24 +30,233 @@ www.navitia.io
 #pragma once
 #include "utils/functions.h"
 #include "utils/idx_map.h"
+#include "utils/idx_map_parallel.h"
+
+#include <boost/functional/hash.hpp>
+#include <boost/iterator/filter_iterator.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/version.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <vector>
 #include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
 
 namespace navitia {
 
+// Storage of the objects of an ObjFactory: one heap allocation per object
+struct HeapStorage {
+    template <typename T>
+    struct Pool {
+        using deleter = std::default_delete<T>;
+
+        template <typename... Args>
+        std::unique_ptr<T, deleter> make(Args&&... args) {
+            return std::make_unique<T>(std::forward<Args>(args)...);
+        }
+
+        // take the ownership of an object allocated with new
+        std::unique_ptr<T, deleter> adopt(T* p) { return std::unique_ptr<T, deleter>(p); }
+    };
+};
+
+/*
+ * Storage of the objects of an ObjFactory in slabs of chunk_size objects
+ *
+ * The objects created one after the other are contiguous, and never
+ * move. The memory of an erased object is reused by the next created
+ * object, the slabs are only freed with the factory.
+ *
+ * The objects loaded from an archive are allocated one by one by boost
+ * with new, they are not in the slabs: ObjFactory::repack() moves them
+ * in the slabs, before anything points to them.
+ */
+template <size_t chunk_size = 1024>
+struct SlabStorage {
+    static_assert(chunk_size > 0, "the slabs can't be empty");
+
+    template <typename T>
+    class Pool {
+        using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+        struct Arena {
+            std::vector<std::unique_ptr<Slot[]>> slabs;
+            size_t nb_used_in_last = chunk_size;
+            std::vector<Slot*> free_slots;
+
+            Slot* allocate() {
+                if (!free_slots.empty()) {
+                    auto* slot = free_slots.back();
+                    free_slots.pop_back();
+                    return slot;
+                }
+                if (nb_used_in_last == chunk_size) {
+                    slabs.push_back(std::unique_ptr<Slot[]>(new Slot[chunk_size]));
+                    nb_used_in_last = 0;
+                }
+                return &slabs.back()[nb_used_in_last++];
+            }
+            void deallocate(void* p) { free_slots.push_back(static_cast<Slot*>(p)); }
+        };
+
+        // the deleters keep a pointer to the arena, it must not move with the pool
+        std::unique_ptr<Arena> arena = std::make_unique<Arena>();
+
+    public:
+        // without arena, the object has been allocated with new
+        struct deleter {
+            Arena* arena = nullptr;
+            void operator()(T* p) const {
+                if (arena == nullptr) {
+                    delete p;
+                    return;
+                }
+                p->~T();
+                arena->deallocate(p);
+            }
+        };
+
+        template <typename... Args>
+        std::unique_ptr<T, deleter> make(Args&&... args) {
+            auto* slot = arena->allocate();
+            try {
+                return std::unique_ptr<T, deleter>(new (slot) T(std::forward<Args>(args)...), deleter{arena.get()});
+            } catch (...) {
+                arena->deallocate(slot);
+                throw;
+            }
+        }
+
+        // take the ownership of an object allocated with new
+        std::unique_ptr<T, deleter> adopt(T* p) { return std::unique_ptr<T, deleter>(p, deleter{}); }
+
+        size_t nb_slabs() const { return arena->slabs.size(); }
+    };
+};
+
 /*
  * Factory handling all collections for one object
  * Object must inherit from navitia::type::Header
+ *
+ * Storage is the allocation strategy of the objects, HeapStorage or
+ * SlabStorage. With both, the objects never move and are accessed
+ * through unique_ptr, with a custom deleter for SlabStorage.
  */
-template <typename ObjType>
+template <typename ObjType, typename Storage = HeapStorage>
 class ObjFactory {
 private:
-    using inner_vector = typename std::vector<std::unique_ptr<ObjType>>;
+    using pool_type = typename Storage::template Pool<ObjType>;
+    using pointer = std::unique_ptr<ObjType, typename pool_type::deleter>;
+    using inner_vector = typename std::vector<pointer>;
     using inner_map = typename std::unordered_map<std::string, ObjType*>;
 
+    // declared before vec, to be destroyed after the objects
+    pool_type pool;
     inner_vector vec;
     inner_map map;
+    // in tombstone mode, the erased objects leave a null slot until compact()
+    bool tombstones = false;
+    size_t nb_tombstones = 0;
+
+    // Once frozen, the uris are looked up in an open addressing table
+    // of the idx, map being empty. The table has a power of 2 size,
+    // and is at most half full.
+    struct FrozenSlot {
+        uint32_t fingerprint;  // high bits of the hash of the uri, to skip most of the uri comparisons
+        idx_t idx;             // invalid_idx for the empty slots
+    };
+    bool frozen = false;
+    std::vector<FrozenSlot> frozen_slots;
+
+    static size_t uri_hash(const boost::string_ref uri) {
+        const uint64_t h = boost::hash_range(uri.begin(), uri.end());
+        // the low bits of boost::hash are not well mixed
+        return size_t(h * 0x9E3779B97F4A7C15ULL);
+    }
+
+    ObjType* find(const std::string& uri) const {
+        if (!frozen) {
+            return find_or_default(uri, map);
+        }
+        return find(boost::string_ref(uri));
+    }
+
+    ObjType* find(const boost::string_ref uri) const {
+        if (!frozen) {
+            return find_or_default(std::string(uri.begin(), uri.end()), map);
+        }
+        if (frozen_slots.empty()) {
+            return nullptr;
+        }
+        const size_t h = uri_hash(uri);
+        const size_t mask = frozen_slots.size() - 1;
+        const auto fingerprint = uint32_t(uint64_t(h) >> 32);
+        for (size_t i = (h >> 8) & mask;; i = (i + 1) & mask) {
+            const auto& slot = frozen_slots[i];
+            if (slot.idx == invalid_idx) {
+                return nullptr;
+            }
+            if (slot.fingerprint == fingerprint && boost::string_ref(vec[slot.idx]->uri) == uri) {
+                return vec[slot.idx].get();
+            }
+        }
+    }
+
+    // Build the frozen table of all the objects, nb_threads threads inserting
+    // them concurrently. Return the idx of an object whose uri is already
+    // in the table, or invalid_idx if the uris are unique.
+    idx_t build_frozen_slots(std::vector<FrozenSlot>& slots, size_t nb_threads) const {
+        size_t capacity = 1;
+        while (capacity < 2 * (vec.size() - nb_tombstones)) {
+            capacity <<= 1;
+        }
+        const size_t mask = capacity - 1;
+        // a slot is packed as fingerprint << 32 | idx, to be set atomically
+        const auto pack = [](uint32_t fingerprint, idx_t idx) { return uint64_t(fingerprint) << 32 | idx; };
+        const uint64_t empty = pack(0, invalid_idx);
+        std::unique_ptr<std::atomic<uint64_t>[]> table(new std::atomic<uint64_t>[capacity]);
+        for (size_t i = 0; i < capacity; ++i) {
+            table[i].store(empty, std::memory_order_relaxed);
+        }
+        std::atomic<idx_t> duplicate{invalid_idx};
+
+        ParallelOptions options;
+        options.nb_threads = nb_threads;
+        options.block_size = 4096;
+        parallel_for_blocks(vec.size(), options, [&](size_t begin, size_t end) {
+            for (size_t idx = begin; idx < end; ++idx) {
+                if (!vec[idx]) {
+                    continue;
+                }
+                const size_t h = uri_hash(vec[idx]->uri);
+                const auto fingerprint = uint32_t(uint64_t(h) >> 32);
+                for (size_t i = (h >> 8) & mask;; i = (i + 1) & mask) {
+                    uint64_t current = table[i].load(std::memory_order_acquire);
+                    if (current == empty) {
+                        if (table[i].compare_exchange_strong(current, pack(fingerprint, idx_t(idx)))) {
+                            break;
+                        }
+                        // another thread took the slot, it must be checked
+                    }
+                    const auto other = idx_t(current & invalid_idx);
+                    if (uint32_t(current >> 32) == fingerprint && vec[other]->uri == vec[idx]->uri) {
+                        duplicate = std::max(other, idx_t(idx));
+                        break;
+                    }
+                }
+            }
+        });
+
+        slots.resize(vec.size() == nb_tombstones ? 0 : capacity);
+        for (size_t i = 0; i < slots.size(); ++i) {
+            const uint64_t slot = table[i].load(std::memory_order_relaxed);
+            slots[i] = {uint32_t(slot >> 32), idx_t(slot & invalid_idx)};
+        }
+        return duplicate;
+    }
 
     void reindex_and_erase(const uint idx) {
         // reindex idx elements
@@ -58,18 +267,108 @@ private:
         vec.erase(vec.begin() + idx);
     }
 
+    // the object must have been removed from the map
+    void remove(const uint idx) {
+        if (tombstones) {
+            vec[idx].reset();
+            ++nb_tombstones;
+        } else {
+            reindex_and_erase(idx);
+        }
+    }
+
+    // erase the marked objects, and the tombstones, in one pass
+    size_t erase_marked(const std::vector<bool>& marked) {
+        size_t nb_erased = 0;
+        for (uint i = 0; i < vec.size(); ++i) {
+            if (marked[i] && vec[i] && map.erase(vec[i]->uri) != 0) {
+                ++nb_erased;
+                vec[i].reset();
+                ++nb_tombstones;
+            }
+        }
+        if (!tombstones) {
+            compact();
+        }
+        return nb_erased;
+    }
+
 public:
-    using iterator = typename inner_vector::iterator;
-    using const_iterator = typename inner_vector::const_iterator;
+    /*
+     * Creation of many objects at once, see ObjFactory::bulk_builder()
+     *
+     * The objects are created without checking their uri, and are only
+     * indexed by finish(): the uris are then checked and the frozen index
+     * is built by several threads. The new objects can't be found by uri
+     * before finish(), and are dropped if finish() is not called.
+     */
+    class BulkBuilder {
+    public:
+        BulkBuilder(BulkBuilder&& other) : factory(other.factory), first(other.first), finished(other.finished) {
+            other.finished = true;
+        }
+        BulkBuilder(const BulkBuilder&) = delete;
+        BulkBuilder& operator=(const BulkBuilder&) = delete;
+        ~BulkBuilder() {
+            if (!finished) {
+                factory.vec.resize(first);
+            }
+        }
+
+        template <typename... Args>
+        ObjType* emplace(const std::string& uri, Args&&... args) {
+            factory.vec.push_back(factory.pool.make(std::forward<Args>(args)...));
+            ObjType* obj = factory.vec.back().get();
+            obj->idx = factory.vec.size() - 1;
+            obj->uri = uri;
+            return obj;
+        }
+
+        // Index the new objects, the factory being frozen at the end.
+        // If an uri is duplicated, all the new objects are dropped and std::logic_error is thrown.
+        void finish(size_t nb_threads = 1) {
+            finished = true;
+            std::vector<FrozenSlot> slots;
+            const idx_t duplicate = factory.build_frozen_slots(slots, nb_threads);
+            if (duplicate != invalid_idx) {
+                const auto uri = factory.vec[duplicate]->uri;
+                factory.vec.resize(first);
+                throw(std::logic_error(std::string("In ") + typeid(factory).name() + ": Object with same uri (" + uri
+                                       + ") already stored."));
+            }
+            factory.frozen_slots = std::move(slots);
+            inner_map().swap(factory.map);
+            factory.frozen = true;
+        }
+
+    private:
+        friend class ObjFactory;
+        BulkBuilder(ObjFactory& f) : factory(f), first(f.vec.size()) {}
+
+        ObjFactory& factory;
+        const size_t first;
+        bool finished = false;
+    };
+
+    // skip the null slots of the erased objects in tombstone mode
+    struct IsAlive {
+        template <typename P>
+        bool operator()(const P& p) const {
+            return p != nullptr;
+        }
+    };
+    using iterator = boost::filter_iterator<IsAlive, typename inner_vector::iterator>;
+    using const_iterator = boost::filter_iterator<IsAlive, typename inner_vector::const_iterator>;
     using const_reference = ObjType const* const;
 
     template <typename... Args>
     ObjType* emplace(const std::string& uri, Args&&... args) {
+        thaw();
         if (navitia::contains(map, uri)) {
             throw(std::logic_error(std::string("In ") + typeid(*this).name() + ": Object with same uri (" + uri
                                    + ") already stored."));
         }
-        vec.push_back(std::make_unique<ObjType>(std::forward<Args>(args)...));
+        vec.push_back(pool.make(std::forward<Args>(args)...));
         ObjType* obj = vec.back().get();
         obj->idx = vec.size() - 1;
         obj->uri = uri;
@@ -88,7 +387,9 @@ public:
 
     ObjType* insert(const std::string& uri, ObjType&& obj) { return emplace(uri, std::move(obj)); }
 
-    const ObjType* operator[](const std::string& uri) const { return find_or_default(uri, map); }
+    const ObjType* operator[](const std::string& uri) const { return find(uri); }
+    const ObjType* operator[](const boost::string_ref uri) const { return find(uri); }
+    const ObjType* operator[](const char* uri) const { return find(boost::string_ref(uri)); }
 
     const ObjType* operator[](const Idx<ObjType>& idx) const {
         if (!exists(idx)) {
@@ -97,7 +398,9 @@ public:
         return vec[idx.val].get();
     }
 
-    ObjType* get_mut(const std::string& uri) { return find_or_default(uri, map); }
+    ObjType* get_mut(const std::string& uri) { return find(uri); }
+    ObjType* get_mut(const boost::string_ref uri) { return find(uri); }
+    ObjType* get_mut(const char* uri) { return find(boost::string_ref(uri)); }
 
     ObjType* get_mut(const Idx<ObjType>& idx) {
         if (!exists(idx)) {
@@ -106,20 +409,23 @@ public:
         return vec[idx.val].get();
     }
 
-    bool exists(const std::string& uri) const { return (map.find(uri) != map.end()); }
+    bool exists(const std::string& uri) const { return find(uri) != nullptr; }
+    bool exists(const boost::string_ref uri) const { return find(uri) != nullptr; }
+    bool exists(const char* uri) const { return find(boost::string_ref(uri)) != nullptr; }
 
-    bool exists(const Idx<ObjType>& idx) const { return (idx.val < vec.size()); }
+    bool exists(const Idx<ObjType>& idx) const { return (idx.val < vec.size() && vec[idx.val] != nullptr); }
 
     bool erase(const Idx<ObjType>& idx) {
         if (!exists(idx)) {
             return false;
         }
+        thaw();
         // erase map member
         const auto* elem_ptr = vec[idx.val].get();
         if (map.erase(elem_ptr->uri) == 0) {
             return false;
         }
-        reindex_and_erase(idx.val);
+        remove(idx.val);
         return true;
     }
 
@@ -127,31 +433,248 @@ public:
         if (!exists(uri)) {
             return false;
         }
+        thaw();
         const auto* elem_ptr = map.at(uri);
         // erase map member
         if (map.erase(uri) == 0) {
             return false;
         }
-        reindex_and_erase(elem_ptr->idx);
+        remove(elem_ptr->idx);
         return true;
     }
 
-    iterator begin() { return std::begin(vec); }
-    const_iterator begin() const { return std::begin(vec); }
-    iterator end() { return std::end(vec); }
-    const_iterator end() const { return std::end(vec); }
+    // Erase several objects with only one reindexing of the remaining ones
+    // return the number of objects erased, the unknown ones being ignored
+    size_t erase_many(const std::vector<Idx<ObjType>>& idxs) {
+        thaw();
+        std::vector<bool> marked(vec.size(), false);
+        for (const auto& idx : idxs) {
+            if (idx.val < vec.size()) {
+                marked[idx.val] = true;
+            }
+        }
+        return erase_marked(marked);
+    }
+
+    size_t erase_many(const std::vector<std::string>& uris) {
+        thaw();
+        std::vector<bool> marked(vec.size(), false);
+        for (const auto& uri : uris) {
+            const auto* obj = find_or_default(uri, map);
+            if (obj != nullptr) {
+                marked[obj->idx] = true;
+            }
+        }
+        return erase_marked(marked);
+    }
+
+    /*
+     * In tombstone mode, an erased object leaves a null slot, so the idx
+     * of the other objects do not change until compact() is called.
+     * The iteration skips the erased objects.
+     * Leaving the tombstone mode compacts the factory.
+     */
+    void enable_tombstones(bool enable = true) {
+        tombstones = enable;
+        if (!enable) {
+            compact();
+        }
+    }
+
+    size_t get_nb_tombstones() const { return nb_tombstones; }
 
+    // remove the null slots of the erased objects, and reindex the other ones
+    void compact() {
+        if (nb_tombstones == 0) {
+            return;
+        }
+        thaw();
+        uint next = 0;
+        for (uint i = 0; i < vec.size(); ++i) {
+            if (vec[i]) {
+                vec[i]->idx = next;
+                if (i != next) {
+                    vec[next] = std::move(vec[i]);
+                }
+                ++next;
+            }
+        }
+        vec.resize(next);
+        nb_tombstones = 0;
+    }
+
+    iterator begin() { return iterator(IsAlive(), vec.begin(), vec.end()); }
+    const_iterator begin() const { return const_iterator(IsAlive(), vec.begin(), vec.end()); }
+    iterator end() { return iterator(IsAlive(), vec.end(), vec.end()); }
+    const_iterator end() const { return const_iterator(IsAlive(), vec.end(), vec.end()); }
+
+    // in tombstone mode, the erased objects not compacted yet are counted
     size_t size() const noexcept { return vec.size(); }
 
+    const pool_type& get_pool() const { return pool; }
+
+    /*
+     * Replace the uri map by a compact table of idx, when the factory
+     * won't be modified anymore. It is smaller than the map, and a lookup
+     * does not allocate a string.
+     * Any modification of the factory thaws it: the map is rebuilt.
+     */
+    void freeze(size_t nb_threads = 1) {
+        if (frozen) {
+            return;
+        }
+        // the uris of the map are unique
+        build_frozen_slots(frozen_slots, nb_threads);
+        inner_map().swap(map);
+        frozen = true;
+    }
+
+    /*
+     * Move the objects in new storage slots, in the order of their idx,
+     * to give their locality back to the objects of a SlabStorage after
+     * a load. The objects must be movable, and the pointers to them, held
+     * by the objects of the other factories for instance, are invalidated:
+     * it must be called before creating those pointers.
+     */
+    void repack() {
+        pool_type packed_pool;
+        inner_vector packed;
+        packed.reserve(vec.size());
+        for (auto& obj : vec) {
+            packed.push_back(obj ? packed_pool.make(std::move(*obj)) : pointer());
+        }
+        // the old objects are destroyed with their pool
+        vec.swap(packed);
+        packed.clear();
+        pool = std::move(packed_pool);
+        if (!frozen) {
+            for (const auto& obj : vec) {
+                if (obj) {
+                    map[obj->uri] = obj.get();
+                }
+            }
+        }
+    }
+
+    // Start the creation of about nb_objects new objects, see BulkBuilder
+    BulkBuilder bulk_builder(size_t nb_objects) {
+        vec.reserve(vec.size() + nb_objects);
+        return BulkBuilder(*this);
+    }
+
+    // Create the objects of the batch, moved from the pairs (uri, object)
+    void insert_many(std::vector<std::pair<std::string, ObjType>>&& batch, size_t nb_threads = 1) {
+        auto builder = bulk_builder(batch.size());
+        for (auto& elt : batch) {
+            builder.emplace(elt.first, std::move(elt.second));
+        }
+        builder.finish(nb_threads);
+    }
+
+    void thaw() {
+        if (!frozen) {
+            return;
+        }
+        map.reserve(vec.size() - nb_tombstones);
+        for (const auto& obj : vec) {
+            if (obj) {
+                map[obj->uri] = obj.get();
+            }
+        }
+        std::vector<FrozenSlot>().swap(frozen_slots);
+        frozen = false;
+    }
+
+    bool is_frozen() const { return frozen; }
+
+    /*
+     * Only the objects are saved, through pointers as other objects may
+     * point to them, and their serialize function must save their uri.
+     * The uri index is rebuilt after the load, by several threads for the
+     * large factories: the loaded factory is frozen.
+     * The tombstones are saved as null pointers, so the idx do not change.
+     *
+     * The version 0 format, saving vec and map, can still be loaded.
+     */
+    template <class Archive>
+    void save(Archive& ar, const unsigned int) const {
+        size_t nb_slots = vec.size();
+        ar& nb_slots;
+        for (const auto& obj : vec) {
+            const ObjType* p = obj.get();
+            ar& p;
+        }
+    }
+
+    template <class Archive>
+    void load(Archive& ar, const unsigned int version) {
+        vec.clear();
+        inner_map().swap(map);
+        std::vector<FrozenSlot>().swap(frozen_slots);
+        frozen = false;
+        nb_tombstones = 0;
+        if (version == 0) {
+            load_with_map(ar, std::is_same<Storage, HeapStorage>());
+            return;
+        }
+
+        size_t nb_slots = 0;
+        ar& nb_slots;
+        vec.reserve(nb_slots);
+        for (size_t i = 0; i < nb_slots; ++i) {
+            // the object may have already been loaded through another pointer
+            ObjType* p = nullptr;
+            ar& p;
+            vec.push_back(pool.adopt(p));
+            if (p == nullptr) {
+                ++nb_tombstones;
+            } else {
+                p->idx = i;
+            }
+        }
+
+        const idx_t duplicate = build_frozen_slots(frozen_slots, vec.size() >= parallel_index_threshold ? 0 : 1);
+        if (duplicate != invalid_idx) {
+            const auto uri = vec[duplicate]->uri;
+            vec.clear();
+            std::vector<FrozenSlot>().swap(frozen_slots);
+            throw(std::logic_error(std::string("In ") + typeid(*this).name() + ": Object with same uri (" + uri
+                                   + ") loaded twice."));
+        }
+        frozen = true;
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+private:
+    // the index of the loaded factories is built in parallel from this number of objects
+    static constexpr size_t parallel_index_threshold = 100000;
+
     template <class Archive>
-    void serialize(Archive& ar, const unsigned int) {
+    void load_with_map(Archive& ar, std::true_type) {
         ar& vec& map;
     }
+    // the version 0 could only be saved with the default storage
+    template <class Archive>
+    void load_with_map(Archive&, std::false_type) {
+        throw std::logic_error("ObjFactory: the version 0 format can only be loaded with HeapStorage");
+    }
 };
 
 }  // namespace navitia
 
-template <typename T>
-const T* find_or_default(const std::string& key, const navitia::ObjFactory<T>& m) {
+namespace boost {
+namespace serialization {
+// version 1: only the objects are saved, see ObjFactory::save
+template <typename T, typename S>
+struct version<navitia::ObjFactory<T, S>> {
+    typedef mpl::int_<1> type;
+    typedef mpl::integral_c_tag tag;
+    BOOST_STATIC_CONSTANT(int, value = version::type::value);
+};
+}  // namespace serialization
+}  // namespace boost
+
+template <typename T, typename S>
+const T* find_or_default(const std::string& key, const navitia::ObjFactory<T, S>& m) {
     return m[key];
 }
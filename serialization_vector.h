@@ -39,3 +39,17 @@ www.navitia.io
 #else
 #include <boost/serialization/vector.hpp>
 #endif
+
+#include <boost/serialization/is_bitwise_serializable.hpp>
+
+#include <type_traits>
+
+// The vectors of a bitwise serializable type are saved and loaded by the
+// binary archives as one block of memory, and so are the arrays wrapped
+// by boost::serialization::make_array, instead of element by element.
+// The arithmetic types are bitwise serializable, this macro declares a
+// trivially copyable type as such. It must be used in the global
+// namespace, and the type must not contain pointers.
+#define NAVITIA_BITWISE_SERIALIZABLE(T)                                                    \
+    static_assert(std::is_trivially_copyable<T>::value, #T " must be trivially copyable"); \
+    BOOST_IS_BITWISE_SERIALIZABLE(T)
@@ -0,0 +1,280 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+#include "utils/idx_map.h"
+#include "utils/idx_set.h"
+
+#include <boost/iterator/iterator_facade.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace navitia {
+
+template <typename T, typename V>
+class SparseIdxMap;
+
+template <typename Map, typename Ref>
+class SparseIdxMapIterator : public boost::iterator_facade<SparseIdxMapIterator<Map, Ref>,
+                                                           std::pair<const typename Map::key_type, Ref>,
+                                                           boost::forward_traversal_tag,
+                                                           std::pair<const typename Map::key_type, Ref>> {
+public:
+    using key_type = typename Map::key_type;
+
+    inline SparseIdxMapIterator() = default;
+    // sparse iteration, on the slots of the table
+    inline SparseIdxMapIterator(Map* m, size_t s) : map(m), slot(s) { skip_empty_slots(); }
+    // dense iteration, on the set indexes
+    inline SparseIdxMapIterator(Map* m, typename IdxSet<typename Map::phantom_type>::const_iterator it)
+        : map(m), dense_it(it) {}
+
+private:
+    friend class boost::iterator_core_access;
+
+    inline void skip_empty_slots() {
+        while (slot < map->keys.size() && map->keys[slot] == invalid_idx) {
+            ++slot;
+        }
+    }
+    inline void increment() {
+        if (map->dense) {
+            ++dense_it;
+        } else {
+            ++slot;
+            skip_empty_slots();
+        }
+    }
+    inline bool equal(const SparseIdxMapIterator& other) const {
+        return map->dense ? dense_it == other.dense_it : slot == other.slot;
+    }
+    inline std::pair<const key_type, Ref> dereference() const {
+        if (map->dense) {
+            return {*dense_it, map->dense_values[dense_it->val]};
+        }
+        return {key_type(map->keys[slot]), map->values[slot]};
+    }
+
+    Map* map = nullptr;
+    size_t slot = 0;
+    typename IdxSet<typename Map::phantom_type>::const_iterator dense_it;
+};
+
+/*
+ * IdxMap for a small subset of a large collection
+ *
+ * The values are stored in a small open addressing table, with a linear
+ * probing. When more than dense_ratio of the indexes are set, the map
+ * switches to a dense storage, like an IdxMap.
+ *
+ * Reading an index that has not been set gives the default value,
+ * writing through the non const operator[] sets it. The iteration only
+ * yields the indexes that have been set: in an unspecified order while
+ * the map is sparse, by increasing index once it is dense.
+ *
+ * Setting a new index invalidates the references to the values and the
+ * iterators.
+ */
+template <typename T, typename V>
+class SparseIdxMap {
+public:
+    using key_type = Idx<T>;
+    using mapped_type = V;
+    using phantom_type = T;
+    using iterator = SparseIdxMapIterator<SparseIdxMap, V&>;
+    using const_iterator = SparseIdxMapIterator<const SparseIdxMap, const V&>;
+
+    inline SparseIdxMap() = default;
+    inline SparseIdxMap(const std::vector<T*>& c, const V& val = V(), double ratio = 0.1)
+        : SparseIdxMap(c.size(), val, ratio) {}
+    inline SparseIdxMap(const std::vector<T>& c, const V& val = V(), double ratio = 0.1)
+        : SparseIdxMap(c.size(), val, ratio) {}
+    inline SparseIdxMap(const size_t size, const V& val = V(), double ratio = 0.1)
+        : nb_idx(size), default_value(val), dense_ratio(ratio) {
+        if (ratio <= 0 || ratio > 1) {
+            throw std::invalid_argument("SparseIdxMap: the dense ratio must be in ]0, 1]");
+        }
+    }
+
+    // accessors
+    // number of possible indexes, like IdxMap::size()
+    inline size_t size() const { return nb_idx; }
+    // number of indexes set
+    inline size_t count() const { return nb_set; }
+    inline bool is_dense() const { return dense; }
+    inline bool contains(const key_type& idx) const {
+        return dense ? present.contains(idx) : !keys.empty() && keys[find_slot(idx.val)] == idx.val;
+    }
+    inline const V& operator[](const key_type& idx) const {
+        if (dense) {
+            return dense_values[idx.val];
+        }
+        if (keys.empty()) {
+            return default_value;
+        }
+        const auto slot = find_slot(idx.val);
+        return keys[slot] == idx.val ? values[slot] : default_value;
+    }
+    inline V& operator[](const key_type& idx) {
+        if (dense) {
+            if (!present.contains(idx)) {
+                present.insert(idx);
+                ++nb_set;
+            }
+            return dense_values[idx.val];
+        }
+        if (!keys.empty()) {
+            const auto slot = find_slot(idx.val);
+            if (keys[slot] == idx.val) {
+                return values[slot];
+            }
+        }
+        return insert(idx);
+    }
+    inline const V& at(const key_type& idx) const { return (*this)[key_type(check(idx))]; }
+    inline V& at(const key_type& idx) { return (*this)[key_type(check(idx))]; }
+    inline const V& get_default() const { return default_value; }
+
+    // unset all the indexes, the map becomes sparse again
+    inline void clear() {
+        keys.assign(keys.size(), invalid_idx);
+        if (dense) {
+            dense = false;
+            dense_values = {};
+            present = IdxSet<T>();
+        }
+        nb_set = 0;
+    }
+
+    // iterator getters
+    inline iterator begin() { return dense ? iterator(this, present.begin()) : iterator(this, 0); }
+    inline iterator end() { return dense ? iterator(this, present.end()) : iterator(this, keys.size()); }
+    inline const_iterator begin() const {
+        return dense ? const_iterator(this, present.begin()) : const_iterator(this, 0);
+    }
+    inline const_iterator end() const {
+        return dense ? const_iterator(this, present.end()) : const_iterator(this, keys.size());
+    }
+    inline const_iterator cbegin() const { return begin(); }
+    inline const_iterator cend() const { return end(); }
+
+private:
+    template <typename, typename>
+    friend class SparseIdxMapIterator;
+
+    static constexpr size_t min_capacity = 16;
+
+    size_t nb_idx = 0;
+    V default_value = V();
+    double dense_ratio = 0.1;
+    size_t nb_set = 0;
+    bool dense = false;
+
+    // sparse storage, the capacity being a power of 2, invalid_idx for the empty slots
+    std::vector<idx_t> keys;
+    std::vector<V> values;
+    unsigned shift = 64;
+
+    // dense storage
+    std::vector<V> dense_values;
+    IdxSet<T> present;
+
+    // slot of idx, or of the empty slot where it would be
+    inline size_t find_slot(const idx_t idx) const {
+        const size_t mask = keys.size() - 1;
+        // fibonacci hashing, the consecutive indexes are spread over the table
+        size_t slot = size_t((uint64_t(idx) * 0x9E3779B97F4A7C15ULL) >> shift);
+        while (keys[slot] != idx && keys[slot] != invalid_idx) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    inline V& insert(const key_type& idx) {
+        if (double(nb_set + 1) > dense_ratio * double(nb_idx)) {
+            to_dense();
+            return (*this)[idx];
+        }
+        // the load factor of the table is kept under 1/2
+        if (2 * (nb_set + 1) > keys.size()) {
+            rehash(std::max(size_t(min_capacity), 2 * keys.size()));
+        }
+        const auto slot = find_slot(idx.val);
+        keys[slot] = idx.val;
+        values[slot] = default_value;
+        ++nb_set;
+        return values[slot];
+    }
+
+    inline void rehash(const size_t capacity) {
+        auto old_keys = std::move(keys);
+        auto old_values = std::move(values);
+        keys.assign(capacity, invalid_idx);
+        values.assign(capacity, default_value);
+        shift = 64;
+        for (size_t c = capacity; c > 1; c >>= 1) {
+            --shift;
+        }
+        for (size_t i = 0; i < old_keys.size(); ++i) {
+            if (old_keys[i] != invalid_idx) {
+                const auto slot = find_slot(old_keys[i]);
+                keys[slot] = old_keys[i];
+                values[slot] = std::move(old_values[i]);
+            }
+        }
+    }
+
+    inline void to_dense() {
+        dense_values.assign(nb_idx, default_value);
+        present.assign(nb_idx);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (keys[i] != invalid_idx) {
+                dense_values[keys[i]] = std::move(values[i]);
+                present.insert(key_type(keys[i]));
+            }
+        }
+        keys = {};
+        values = {};
+        dense = true;
+    }
+
+    inline idx_t check(const key_type& idx) const {
+        if (idx.val >= nb_idx) {
+            throw std::out_of_range("SparseIdxMap::at");
+        }
+        return idx.val;
+    }
+};
+
+}  // namespace navitia
@@ -29,6 +29,20 @@ www.navitia.io
 */
 
 #include "utils/idx_map.h"
+#include "utils/idx_set.h"
+#include "utils/csr_idx_map.h"
+#include "utils/idx_soa.h"
+#include "utils/idx_map_accumulator.h"
+#include "utils/idx_map_parallel.h"
+#include "utils/sparse_idx_map.h"
+#include "utils/cow_idx_map.h"
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <map>
+#include <sstream>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE idx_map_test
@@ -44,6 +58,13 @@ struct Bob {
     navitia::idx_t idx;
 };
 
+// no serialize function: it can only be saved as bytes
+struct Label {
+    uint32_t time;
+    uint16_t nb_transfers;
+};
+NAVITIA_BITWISE_SERIALIZABLE(Label)
+
 BOOST_AUTO_TEST_CASE(idx_constructor) {
     const Bob bob(int(0));
     navitia::Idx<Bob> idx = navitia::Idx<Bob>(bob);
@@ -110,3 +131,423 @@ BOOST_AUTO_TEST_CASE(idx_map_iterations_read_write) {
         ++idx;
     }
 }
+
+BOOST_AUTO_TEST_CASE(generation_idx_map_reset) {
+    std::vector<Bob> bob_container;
+    for (size_t i = 0; i < 42; ++i) {
+        bob_container.emplace_back(Bob(i));
+    }
+    const auto idx = [](navitia::idx_t i) { return navitia::Idx<Bob>(i); };
+
+    navitia::GenerationIdxMap<Bob, int> map;
+    map.assign(bob_container, -1);
+    const auto& const_map = map;
+    BOOST_CHECK_EQUAL(map.size(), 42);
+    BOOST_CHECK_EQUAL(const_map[idx(3)], -1);
+    BOOST_CHECK(!map.is_set(idx(3)));
+
+    // a mutable access sets the value
+    map[idx(3)] = 3;
+    map[idx(5)] += 10;
+    BOOST_CHECK_EQUAL(const_map[idx(3)], 3);
+    BOOST_CHECK_EQUAL(const_map[idx(5)], 9);
+    BOOST_CHECK_EQUAL(const_map[idx(4)], -1);
+    BOOST_CHECK(map.is_set(idx(3)));
+
+    // after a reset, the old values are not visible anymore
+    map.reset();
+    BOOST_CHECK_EQUAL(const_map[idx(3)], -1);
+    BOOST_CHECK_EQUAL(const_map[idx(5)], -1);
+    BOOST_CHECK(!map.is_set(idx(3)));
+    map[idx(5)] = 5;
+    BOOST_CHECK_EQUAL(const_map.at(idx(5)), 5);
+    BOOST_CHECK_THROW(const_map.at(idx(42)), std::out_of_range);
+
+    // assign with the same size is a reset with a new default value
+    map.assign(bob_container, 0);
+    BOOST_CHECK_EQUAL(const_map[idx(5)], 0);
+    BOOST_CHECK_EQUAL(const_map[idx(3)], 0);
+}
+
+BOOST_AUTO_TEST_CASE(idx_set) {
+    const auto idx = [](navitia::idx_t i) { return navitia::Idx<Bob>(i); };
+    navitia::IdxSet<Bob> set(200);
+    BOOST_CHECK_EQUAL(set.size(), 200);
+    BOOST_CHECK(set.empty());
+
+    for (navitia::idx_t i : {0, 3, 63, 64, 130, 199}) {
+        set.insert(idx(i));
+    }
+    BOOST_CHECK_EQUAL(set.count(), 6);
+    BOOST_CHECK(set.contains(idx(63)));
+    BOOST_CHECK(!set.contains(idx(62)));
+    set.erase(idx(3));
+    BOOST_CHECK(!set.contains(idx(3)));
+
+    std::vector<navitia::idx_t> elts;
+    for (const auto i : set) {
+        elts.push_back(i.val);
+    }
+    const std::vector<navitia::idx_t> expected = {0, 63, 64, 130, 199};
+    BOOST_CHECK_EQUAL_COLLECTIONS(elts.begin(), elts.end(), expected.begin(), expected.end());
+
+    navitia::IdxSet<Bob> other(200);
+    other.insert(idx(64));
+    other.insert(idx(100));
+    BOOST_CHECK_EQUAL((set | other).count(), 6);
+    BOOST_CHECK_EQUAL((set & other).count(), 1);
+    BOOST_CHECK((set & other).contains(idx(64)));
+    BOOST_CHECK_EQUAL((set - other).count(), 4);
+    BOOST_CHECK(!(set - other).contains(idx(64)));
+
+    // an operation with itself
+    auto self = set;
+    self |= self;
+    BOOST_CHECK(self == set);
+    self &= self;
+    BOOST_CHECK(self == set);
+    self -= self;
+    BOOST_CHECK(self.empty());
+
+    navitia::IdxSet<Bob> full(70);
+    full.fill();
+    BOOST_CHECK_EQUAL(full.count(), 70);
+    BOOST_CHECK_EQUAL(std::distance(full.begin(), full.end()), 70);
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << set;
+    }
+    navitia::IdxSet<Bob> loaded;
+    boost::archive::binary_iarchive ia(ss);
+    ia >> loaded;
+    BOOST_CHECK(loaded == set);
+}
+
+BOOST_AUTO_TEST_CASE(csr_idx_map) {
+    navitia::IdxMap<Bob, std::vector<int>> jagged(4);
+    jagged[navitia::Idx<Bob>(0)] = {1, 2};
+    jagged[navitia::Idx<Bob>(2)] = {3};
+    jagged[navitia::Idx<Bob>(3)] = {4, 5, 6};
+
+    const navitia::CsrIdxMap<Bob, int> csr(jagged);
+    BOOST_CHECK_EQUAL(csr.size(), 4);
+    BOOST_CHECK_EQUAL(csr.nb_values(), 6);
+    for (const auto& elt : jagged) {
+        const auto range = csr[elt.first];
+        BOOST_CHECK_EQUAL_COLLECTIONS(range.begin(), range.end(), elt.second.begin(), elt.second.end());
+    }
+    BOOST_CHECK(csr[navitia::Idx<Bob>(1)].empty());
+    BOOST_CHECK_THROW(csr.at(navitia::Idx<Bob>(4)), std::out_of_range);
+
+    navitia::idx_t nb_keys = 0;
+    for (const auto& elt : csr) {
+        BOOST_CHECK_EQUAL(elt.first.val, nb_keys++);
+        BOOST_CHECK_EQUAL(elt.second.size(), jagged[elt.first].size());
+    }
+    BOOST_CHECK_EQUAL(nb_keys, 4);
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << csr;
+    }
+    navitia::CsrIdxMap<Bob, int> loaded;
+    boost::archive::binary_iarchive ia(ss);
+    ia >> loaded;
+    BOOST_CHECK_EQUAL(loaded.size(), 4);
+    BOOST_CHECK_EQUAL_COLLECTIONS(loaded.values().begin(), loaded.values().end(), csr.values().begin(),
+                                  csr.values().end());
+}
+
+BOOST_AUTO_TEST_CASE(idx_soa) {
+    navitia::IdxSoA<Bob, int, double, std::string> soa(3, std::make_tuple(1, 0.5, "a"));
+    const auto idx = navitia::Idx<Bob>(1);
+    BOOST_CHECK_EQUAL(soa.size(), 3);
+    BOOST_CHECK_EQUAL(soa.get<0>(idx), 1);
+    BOOST_CHECK_EQUAL(soa.get<2>(idx), "a");
+
+    soa.get<0>(idx) = 42;
+    std::get<1>(soa[idx]) = 2.5;
+    soa.at(navitia::Idx<Bob>(2)) = std::make_tuple(3, 1.5, "c");
+    BOOST_CHECK_THROW(soa.at(navitia::Idx<Bob>(3)), std::out_of_range);
+
+    const auto& const_soa = soa;
+    BOOST_CHECK_EQUAL(std::get<0>(const_soa[idx]), 42);
+    BOOST_CHECK_EQUAL(const_soa.get<1>(idx), 2.5);
+    BOOST_CHECK_EQUAL(const_soa.get<2>(navitia::Idx<Bob>(2)), "c");
+
+    int sum = 0;
+    for (const auto i : const_soa.field<0>()) {
+        sum += i;
+    }
+    BOOST_CHECK_EQUAL(sum, 1 + 42 + 3);
+    for (auto& d : soa.field<1>()) {
+        d *= 2;
+    }
+    BOOST_CHECK_EQUAL(soa.get<1>(idx), 5.);
+
+    navitia::idx_t nb = 0;
+    for (const auto& elt : const_soa) {
+        BOOST_CHECK_EQUAL(elt.first.val, nb++);
+        BOOST_CHECK_EQUAL(std::get<0>(elt.second), const_soa.get<0>(elt.first));
+    }
+    BOOST_CHECK_EQUAL(nb, 3);
+
+    soa.resize(5);
+    BOOST_CHECK_EQUAL(soa.size(), 5);
+    BOOST_CHECK_EQUAL(soa.get<0>(navitia::Idx<Bob>(4)), 0);
+}
+
+BOOST_AUTO_TEST_CASE(idx_map_accumulator) {
+    const size_t size = 10000;
+    const size_t nb_threads = 4;
+    for (const bool sparse : {false, true}) {
+        auto sum = navitia::make_idx_map_accumulator<Bob>(size, nb_threads, 0, std::plus<int>(), sparse);
+        auto min = navitia::make_idx_map_accumulator<Bob>(
+            size, nb_threads, std::numeric_limits<int>::max(), [](int a, int b) { return std::min(a, b); }, sparse);
+        for (size_t t = 0; t < nb_threads; ++t) {
+            BOOST_CHECK_EQUAL(reinterpret_cast<uintptr_t>(&sum.partition(t)) % navitia::cache_line_size, 0);
+        }
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < nb_threads; ++t) {
+            workers.emplace_back([&, t]() {
+                // each thread adds 1 to the multiples of t + 1, twice
+                for (int n = 0; n < 2; ++n) {
+                    for (navitia::idx_t i = 0; i < size; i += t + 1) {
+                        sum.partition(t).add(navitia::Idx<Bob>(i), 1);
+                        min.partition(t).add(navitia::Idx<Bob>(i), int(t + n));
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+
+        const auto sums = sum.merge(3);
+        const auto mins = min.merge(3);
+        BOOST_REQUIRE_EQUAL(sums.size(), size);
+        for (navitia::idx_t i = 0; i < size; ++i) {
+            int expected_sum = 0;
+            int expected_min = std::numeric_limits<int>::max();
+            for (size_t t = nb_threads; t-- > 0;) {
+                if (i % (t + 1) == 0) {
+                    expected_sum += 2;
+                    expected_min = int(t);
+                }
+            }
+            BOOST_CHECK_EQUAL(sums[navitia::Idx<Bob>(i)], expected_sum);
+            BOOST_CHECK_EQUAL(mins[navitia::Idx<Bob>(i)], expected_min);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compact_idx) {
+    BOOST_CHECK_EQUAL(sizeof(navitia::Idx16<Bob>), 2);
+    BOOST_CHECK_EQUAL(sizeof(navitia::Idx8<Bob>), 1);
+    BOOST_CHECK(!navitia::Idx16<Bob>().is_valid());
+
+    const navitia::Idx<Bob> idx(1000);
+    const auto small = navitia::idx_cast<uint16_t>(idx);
+    BOOST_CHECK_EQUAL(small.val, 1000);
+    BOOST_CHECK(navitia::idx_cast<navitia::idx_t>(small) == idx);
+    BOOST_CHECK_THROW(navitia::idx_cast<uint8_t>(idx), std::out_of_range);
+    BOOST_CHECK_THROW(navitia::idx_cast<uint16_t>(navitia::Idx<Bob>(70000)), std::out_of_range);
+    BOOST_CHECK(!navitia::idx_cast<uint16_t>(navitia::Idx<Bob>()).is_valid());
+    BOOST_CHECK(!navitia::idx_cast<navitia::idx_t>(navitia::Idx16<Bob>()).is_valid());
+
+    // from an object, the idx is checked too
+    BOOST_CHECK_EQUAL(navitia::Idx16<Bob>(Bob(1000)).val, 1000);
+    BOOST_CHECK_THROW(navitia::Idx16<Bob>(Bob(70000)), std::out_of_range);
+    BOOST_CHECK_THROW(navitia::Idx8<Bob>(Bob(255)), std::out_of_range);
+    BOOST_CHECK(!navitia::Idx16<Bob>(Bob(navitia::invalid_idx)).is_valid());
+
+    std::stringstream ss;
+    ss << navitia::Idx8<Bob>(65);
+    BOOST_CHECK_EQUAL(ss.str(), "65");
+
+    navitia::IdxMap16<Bob, int> map(10, 1);
+    map[navitia::Idx16<Bob>(3)] = 42;
+    BOOST_CHECK_EQUAL(map[navitia::Idx16<Bob>(3)], 42);
+    int sum = 0;
+    for (const auto& elt : map) {
+        BOOST_CHECK((std::is_same<decltype(elt.first), const navitia::Idx16<Bob>>::value));
+        sum += elt.second;
+    }
+    BOOST_CHECK_EQUAL(sum, 42 + 9);
+    BOOST_CHECK_THROW((navitia::IdxMap<Bob, int, uint8_t>(256)), std::out_of_range);
+    BOOST_CHECK_EQUAL((navitia::IdxMap<Bob, int, uint8_t>(255)).size(), 255);
+}
+
+BOOST_AUTO_TEST_CASE(idx_map_parallel_algorithms) {
+    navitia::ParallelOptions options;
+    options.nb_threads = 4;
+    options.block_size = 100;
+    navitia::IdxMap<Bob, int> map(10001);
+
+    navitia::parallel_for_each(map, [](const navitia::Idx<Bob>& idx, int& value) { value = int(idx.val); }, options);
+    for (const auto& elt : map) {
+        BOOST_CHECK_EQUAL(elt.second, int(elt.first.val));
+    }
+
+    navitia::parallel_for_each(map.values(), [](int& value) { value *= 2; }, options);
+    BOOST_CHECK_EQUAL(map[navitia::Idx<Bob>(10000)], 20000);
+
+    navitia::IdxMap<Bob, std::string> strings;
+    navitia::parallel_transform(
+        map, strings, [](const navitia::Idx<Bob>&, int value) { return std::to_string(value); }, options);
+    BOOST_REQUIRE_EQUAL(strings.size(), map.size());
+    BOOST_CHECK_EQUAL(strings[navitia::Idx<Bob>(42)], "84");
+
+    const auto sum = navitia::parallel_reduce(
+        map, int64_t(0), [](int64_t acc, const navitia::Idx<Bob>&, int value) { return acc + value; },
+        std::plus<int64_t>(), options);
+    BOOST_CHECK_EQUAL(sum, int64_t(10000) * 10001);
+
+    // the blocks are combined in order
+    const auto concat = navitia::parallel_reduce(
+        strings, std::string(),
+        [](std::string acc, const navitia::Idx<Bob>& idx, const std::string&) {
+            return idx.val < 20 ? acc + char('a' + idx.val) : acc;
+        },
+        std::plus<std::string>(), options);
+    BOOST_CHECK_EQUAL(concat, "abcdefghijklmnopqrst");
+
+    BOOST_CHECK_THROW(navitia::parallel_for_each(map,
+                                                 [](const navitia::Idx<Bob>& idx, int&) {
+                                                     if (idx.val == 5000) {
+                                                         throw std::runtime_error("bob");
+                                                     }
+                                                 },
+                                                 options),
+                      std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sparse_idx_map) {
+    const auto idx = [](navitia::idx_t i) { return navitia::Idx<Bob>(i); };
+    navitia::SparseIdxMap<Bob, int> map(1000, -1);
+    const auto& const_map = map;
+    BOOST_CHECK_EQUAL(map.size(), 1000);
+    BOOST_CHECK_EQUAL(const_map[idx(42)], -1);
+    BOOST_CHECK(!map.contains(idx(42)));
+    BOOST_CHECK(map.begin() == map.end());
+
+    // under the 10% dense ratio, the map stays sparse
+    std::map<navitia::idx_t, int> expected;
+    for (navitia::idx_t i = 0; i < 100; ++i) {
+        map[idx(i * 7)] = int(i);
+        expected[i * 7] = int(i);
+    }
+    BOOST_CHECK(!map.is_dense());
+    BOOST_CHECK_EQUAL(map.count(), 100);
+    BOOST_CHECK_EQUAL(const_map[idx(14)], 2);
+    BOOST_CHECK_EQUAL(const_map[idx(15)], -1);
+    BOOST_CHECK(map.contains(idx(693)));
+    BOOST_CHECK_THROW(map.at(idx(1000)), std::out_of_range);
+    std::map<navitia::idx_t, int> got;
+    for (const auto& elt : const_map) {
+        got[elt.first.val] = elt.second;
+    }
+    BOOST_CHECK(got == expected);
+
+    // one more and it becomes dense
+    map[idx(999)] += 2;
+    expected[999] = 1;
+    BOOST_CHECK(map.is_dense());
+    BOOST_CHECK_EQUAL(map.count(), 101);
+    BOOST_CHECK_EQUAL(const_map[idx(14)], 2);
+    BOOST_CHECK_EQUAL(const_map[idx(999)], 1);
+    BOOST_CHECK_EQUAL(const_map[idx(15)], -1);
+    std::vector<std::pair<navitia::idx_t, int>> dense_elts;
+    for (auto elt : map) {
+        dense_elts.emplace_back(elt.first.val, elt.second);
+    }
+    const std::vector<std::pair<navitia::idx_t, int>> expected_elts(expected.begin(), expected.end());
+    BOOST_CHECK(dense_elts == expected_elts);
+
+    map.clear();
+    BOOST_CHECK(!map.is_dense());
+    BOOST_CHECK_EQUAL(map.count(), 0);
+    BOOST_CHECK_EQUAL(const_map[idx(14)], -1);
+    map[idx(3)] = 3;
+    BOOST_CHECK_EQUAL(const_map[idx(3)], 3);
+    BOOST_CHECK_THROW((navitia::SparseIdxMap<Bob, int>(10, 0, 0.)), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(idx_map_serialization) {
+    navitia::IdxMap<Bob, Label> labels(1000);
+    navitia::IdxMap<Bob, navitia::Idx<Bob>> parents(1000);
+    navitia::IdxMap<Bob, std::string> names(3);
+    for (auto elt : labels) {
+        elt.second = {elt.first.val * 3, uint16_t(elt.first.val % 5)};
+        parents[elt.first] = navitia::Idx<Bob>(elt.first.val / 2);
+    }
+    names[navitia::Idx<Bob>(1)] = "bob";
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << labels << parents << names;
+    }
+    navitia::IdxMap<Bob, Label> loaded_labels;
+    navitia::IdxMap<Bob, navitia::Idx<Bob>> loaded_parents;
+    navitia::IdxMap<Bob, std::string> loaded_names;
+    boost::archive::binary_iarchive ia(ss);
+    ia >> loaded_labels >> loaded_parents >> loaded_names;
+
+    BOOST_REQUIRE_EQUAL(loaded_labels.size(), 1000);
+    BOOST_REQUIRE_EQUAL(loaded_parents.size(), 1000);
+    for (const auto& elt : loaded_labels) {
+        BOOST_CHECK_EQUAL(elt.second.time, labels[elt.first].time);
+        BOOST_CHECK_EQUAL(elt.second.nb_transfers, labels[elt.first].nb_transfers);
+        BOOST_CHECK_EQUAL(loaded_parents[elt.first], parents[elt.first]);
+    }
+    BOOST_CHECK_EQUAL(loaded_names[navitia::Idx<Bob>(1)], "bob");
+    BOOST_CHECK_EQUAL(loaded_names[navitia::Idx<Bob>(2)], "");
+}
+
+BOOST_AUTO_TEST_CASE(cow_idx_map_snapshot) {
+    const auto idx = [](navitia::idx_t i) { return navitia::Idx<Bob>(i); };
+    navitia::CowIdxMap<Bob, int, 16> map(100, 1);
+    const auto& const_map = map;
+    BOOST_CHECK_EQUAL(map.size(), 100);
+    BOOST_CHECK_EQUAL(map.nb_pages(), 7);
+    BOOST_CHECK_EQUAL(const_map[idx(99)], 1);
+    BOOST_CHECK_THROW(const_map.at(idx(100)), std::out_of_range);
+
+    const auto snapshot = map.snapshot();
+    BOOST_CHECK_EQUAL(&snapshot[idx(0)], &const_map[idx(0)]);
+
+    // only the written page is cloned
+    map[idx(20)] = 42;
+    BOOST_CHECK_EQUAL(const_map[idx(20)], 42);
+    BOOST_CHECK_EQUAL(snapshot[idx(20)], 1);
+    BOOST_CHECK_NE(&snapshot[idx(16)], &const_map[idx(16)]);
+    BOOST_CHECK_EQUAL(&snapshot[idx(0)], &const_map[idx(0)]);
+    BOOST_CHECK_EQUAL(&snapshot[idx(32)], &const_map[idx(32)]);
+
+    // the page is not shared anymore, it is written in place
+    const int* written = &const_map[idx(21)];
+    map[idx(21)] = 43;
+    BOOST_CHECK_EQUAL(&const_map[idx(21)], written);
+
+    int sum = 0;
+    for (const auto& elt : snapshot) {
+        sum += elt.second;
+    }
+    BOOST_CHECK_EQUAL(sum, 100);
+    sum = 0;
+    for (const auto& elt : const_map) {
+        sum += elt.second;
+    }
+    BOOST_CHECK_EQUAL(sum, 98 + 42 + 43);
+
+    // a write in a snapshot clones its page too
+    auto copy = map.snapshot();
+    copy[idx(0)] = 7;
+    BOOST_CHECK_EQUAL(copy[idx(0)], 7);
+    BOOST_CHECK_EQUAL(const_map[idx(0)], 1);
+    BOOST_CHECK_EQUAL(snapshot[idx(0)], 1);
+}
@@ -0,0 +1,310 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+/*
+ * Benchmark of the Lru family
+ *
+ * Each configuration runs nb_threads threads calling the cache with keys
+ * following a Zipf distribution, with optional bursts of one-off keys
+ * (scans), the cached function spinning for a given cost. The
+ * throughput, the latency percentiles of a call and the hit ratio
+ * are printed for each configuration.
+ *
+ * usage: lru_bench [--caches=lru,concurrent,tinylfu,front] [--threads=1,4]
+ *                  [--zipf=0.8,1.2] [--scan=0,0.01] [--cost=1,100]
+ *                  [--keys=100000] [--size=1000] [--scan_length=100] [--ops=200000]
+ * where scan is the probability of starting a scan at each call, cost is
+ * in microseconds and ops is the number of calls by thread.
+ */
+
+#include "utils/lru.h"
+
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Config {
+    std::string cache;
+    size_t nb_threads;
+    double zipf;
+    double scan;
+    size_t cost_us;
+    size_t nb_keys;
+    size_t cache_size;
+    size_t scan_length;
+    size_t nb_ops;
+};
+
+struct Result {
+    double throughput = 0;  // calls by second
+    double p50_us = 0;
+    double p99_us = 0;
+    double hit_ratio = 0;
+};
+
+// the cached function, burning cpu during cost_us
+struct SpinFun {
+    typedef uint64_t const& argument_type;
+    using result_type = uint64_t;
+    size_t cost_us;
+    uint64_t operator()(const uint64_t& key) const {
+        const auto end = clock_type::now() + std::chrono::microseconds(cost_us);
+        uint64_t res = key;
+        while (clock_type::now() < end) {
+            res = res * 6364136223846793005ULL + 1442695040888963407ULL;
+        }
+        return res;
+    }
+};
+
+// draw keys in [0, n[ with P(k) proportional to 1 / (k + 1)^s
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double s) : cdf(n) {
+        double sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            sum += 1. / std::pow(double(k + 1), s);
+            cdf[k] = sum;
+        }
+        for (auto& p : cdf) {
+            p /= sum;
+        }
+    }
+    template <typename Rng>
+    uint64_t operator()(Rng& rng) const {
+        const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        return uint64_t(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+
+private:
+    std::vector<double> cdf;
+};
+
+// the keys called by a thread: zipf distributed keys and scans of one-off keys
+std::vector<uint64_t> make_keys(const Config& conf, const ZipfGenerator& zipf, size_t thread_idx) {
+    std::mt19937_64 rng(thread_idx + 42);
+    std::bernoulli_distribution start_scan(conf.scan);
+    // the scanned keys are outside of the zipf keys, and are not shared by the threads
+    uint64_t next_scanned = conf.nb_keys + thread_idx * conf.nb_ops;
+    std::vector<uint64_t> keys;
+    keys.reserve(conf.nb_ops);
+    while (keys.size() < conf.nb_ops) {
+        if (conf.scan > 0 && start_scan(rng)) {
+            for (size_t i = 0; i < conf.scan_length && keys.size() < conf.nb_ops; ++i) {
+                keys.push_back(next_scanned++);
+            }
+        } else {
+            keys.push_back(zipf(rng));
+        }
+    }
+    return keys;
+}
+
+template <typename Cache>
+Result run(Cache& cache, const Config& conf, const ZipfGenerator& zipf) {
+    std::vector<std::vector<uint64_t>> keys;
+    for (size_t t = 0; t < conf.nb_threads; ++t) {
+        keys.push_back(make_keys(conf, zipf, t));
+    }
+    std::vector<std::vector<uint32_t>> latencies(conf.nb_threads);
+    const auto start = clock_type::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < conf.nb_threads; ++t) {
+        threads.emplace_back([&, t]() {
+            auto& lat = latencies[t];
+            lat.reserve(conf.nb_ops);
+            uint64_t sink = 0;
+            for (const auto key : keys[t]) {
+                const auto call_start = clock_type::now();
+                sink += cache(key);
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - call_start);
+                lat.push_back(uint32_t(std::min<int64_t>(ns.count(), UINT32_MAX)));
+            }
+            // avoid the optimization of the calls
+            if (sink == 42) {
+                std::puts("");
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    const std::chrono::duration<double> elapsed = clock_type::now() - start;
+
+    std::vector<uint32_t> all;
+    for (const auto& lat : latencies) {
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    Result res;
+    const size_t nb_calls = all.size();
+    res.throughput = double(nb_calls) / elapsed.count();
+    const auto percentile = [&](double p) {
+        auto nth = all.begin() + ptrdiff_t(p * double(all.size() - 1));
+        std::nth_element(all.begin(), nth, all.end());
+        return double(*nth) / 1000.;
+    };
+    res.p50_us = percentile(0.5);
+    res.p99_us = percentile(0.99);
+    // the hits in the front caches don't reach the shared cache
+    const auto stats = cache.get_stats();
+    const auto nb_cache_calls = stats.nb_calls + stats.nb_front_cache_hits;
+    res.hit_ratio = double(nb_cache_calls - stats.nb_misses) / double(nb_cache_calls);
+    return res;
+}
+
+// dereference the result of a Lru (a value) or of a ConcurrentLru (a shared_ptr)
+template <typename T>
+const T& value_of(const T& t) {
+    return t;
+}
+template <typename T>
+const T& value_of(const std::shared_ptr<const T>& t) {
+    return *t;
+}
+
+// adapt the cache to run, as results are either values or shared_ptr
+template <typename Cache>
+struct Adapter {
+    Cache cache;
+    uint64_t operator()(uint64_t key) const { return value_of(cache(key)); }
+    navitia::LruStats get_stats() const { return cache.get_stats(); }
+};
+template <typename Cache>
+Adapter<Cache> adapt(Cache&& cache) {
+    return Adapter<Cache>{std::move(cache)};
+}
+
+bool run_config(const Config& conf, const ZipfGenerator& zipf, Result& res) {
+    if (conf.cache == "lru") {
+        // a Lru can't be shared across threads
+        if (conf.nb_threads != 1) {
+            return false;
+        }
+        auto cache = adapt(navitia::make_lru(SpinFun{conf.cost_us}, conf.cache_size));
+        res = run(cache, conf, zipf);
+    } else if (conf.cache == "concurrent") {
+        auto cache = adapt(navitia::make_concurrent_lru(SpinFun{conf.cost_us}, conf.cache_size));
+        res = run(cache, conf, zipf);
+    } else if (conf.cache == "tinylfu") {
+        auto cache = adapt(
+            navitia::make_concurrent_lru(SpinFun{conf.cost_us}, conf.cache_size, navitia::TinyLfu(conf.cache_size)));
+        res = run(cache, conf, zipf);
+    } else if (conf.cache == "front") {
+        auto cache = adapt(navitia::make_concurrent_lru(SpinFun{conf.cost_us}, conf.cache_size));
+        cache.cache.enable_front_cache(8);
+        res = run(cache, conf, zipf);
+    } else {
+        throw std::invalid_argument("unknown cache " + conf.cache);
+    }
+    return true;
+}
+
+template <typename T>
+std::vector<T> parse_list(const std::string& str) {
+    std::vector<std::string> items;
+    boost::split(items, str, boost::is_any_of(","));
+    std::vector<T> res;
+    for (const auto& item : items) {
+        res.push_back(boost::lexical_cast<T>(item));
+    }
+    return res;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::map<std::string, std::string> args = {
+        {"caches", "lru,concurrent,tinylfu,front"},
+        {"threads", "1,4"},
+        {"zipf", "0.8,1.2"},
+        {"scan", "0,0.01"},
+        {"cost", "1,100"},
+        {"keys", "100000"},
+        {"size", "1000"},
+        {"scan_length", "100"},
+        {"ops", "200000"},
+    };
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos || !args.count(arg.substr(2, eq - 2))) {
+            std::fprintf(stderr, "invalid argument %s, see the header of lru_bench.cpp\n", arg.c_str());
+            return 1;
+        }
+        args[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+
+    std::printf("%-12s %8s %6s %6s %8s %14s %10s %10s %8s\n", "cache", "threads", "zipf", "scan", "cost_us",
+                "calls/s", "p50_us", "p99_us", "hit");
+    for (const auto zipf_s : parse_list<double>(args["zipf"])) {
+        const ZipfGenerator zipf(boost::lexical_cast<size_t>(args["keys"]), zipf_s);
+        for (const auto scan : parse_list<double>(args["scan"])) {
+            for (const auto cost : parse_list<size_t>(args["cost"])) {
+                for (const auto nb_threads : parse_list<size_t>(args["threads"])) {
+                    for (const auto& cache : parse_list<std::string>(args["caches"])) {
+                        const Config conf{cache,
+                                          nb_threads,
+                                          zipf_s,
+                                          scan,
+                                          cost,
+                                          boost::lexical_cast<size_t>(args["keys"]),
+                                          boost::lexical_cast<size_t>(args["size"]),
+                                          boost::lexical_cast<size_t>(args["scan_length"]),
+                                          boost::lexical_cast<size_t>(args["ops"])};
+                        Result res;
+                        if (!run_config(conf, zipf, res)) {
+                            continue;
+                        }
+                        std::printf("%-12s %8zu %6.2f %6.3f %8zu %14.0f %10.2f %10.2f %8.4f\n", cache.c_str(),
+                                    nb_threads, zipf_s, scan, cost, res.throughput, res.p50_us, res.p99_us,
+                                    res.hit_ratio);
+                        std::fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
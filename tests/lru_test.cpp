@@ -30,10 +30,29 @@ www.navitia.io
 
 #include "utils/lru.h"
 
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE lru_test
 #include <boost/test/unit_test.hpp>
 
+// poll the condition until it holds, false if it still does not after the timeout
+template <typename Cond>
+static bool eventually(Cond cond, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
 struct Fun {
     typedef int const& argument_type;
     using result_type = int;
@@ -122,3 +141,450 @@ BOOST_AUTO_TEST_CASE(concurrent_lru) {
     BOOST_CHECK_EQUAL(*lru(1), 2);
     BOOST_CHECK_EQUAL(nb_call, 4);
 }
+
+BOOST_AUTO_TEST_CASE(tiny_lfu_lru_resists_scan) {
+    size_t nb_call = 0;
+
+    // a Lru with 2 elements cached, only admitting new entries more
+    // frequently used than the least recently used one
+    auto lru = navitia::make_lru(Fun(nb_call), 2, navitia::TinyLfu(16));
+
+    // cache = { 1 -> 2, 2 -> 4 }, 1 and 2 being hot
+    for (int i = 0; i < 3; ++i) {
+        BOOST_CHECK_EQUAL(lru(1), 2);
+        BOOST_CHECK_EQUAL(lru(2), 4);
+    }
+    BOOST_CHECK_EQUAL(nb_call, 2);
+
+    // a scan of one-off keys is computed but not cached
+    for (int i = 100; i < 110; ++i) {
+        BOOST_CHECK_EQUAL(lru(i), i * 2);
+    }
+    BOOST_CHECK_EQUAL(nb_call, 12);
+    BOOST_CHECK_EQUAL(lru.get_nb_admission_rejected(), 10);
+
+    // the hot entries are still there
+    BOOST_CHECK_EQUAL(lru(1), 2);
+    BOOST_CHECK_EQUAL(lru(2), 4);
+    BOOST_CHECK_EQUAL(nb_call, 12);
+    BOOST_CHECK_EQUAL(lru.get_nb_cache_miss(), 12);
+
+    // a key becoming popular ends up being cached
+    for (int i = 0; i < 5; ++i) {
+        BOOST_CHECK_EQUAL(lru(100), 200);
+    }
+    BOOST_CHECK_EQUAL(lru(100), 200);
+    BOOST_CHECK_LT(nb_call, 18);
+}
+
+BOOST_AUTO_TEST_CASE(tiny_lfu_concurrent_lru) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(Fun(nb_call), 1, navitia::TinyLfu(16));
+
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+    BOOST_CHECK_EQUAL(lru.get_nb_admission_rejected(), 1);
+}
+
+// a function whose cost is the value of its argument, in ms
+struct SlowFun {
+    typedef int const& argument_type;
+    using result_type = int;
+    size_t& nb_call;
+    SlowFun(size_t& nb): nb_call(nb) {}
+    int operator()(const int& i) const {
+        ++nb_call;
+        std::this_thread::sleep_for(std::chrono::milliseconds(i));
+        return i;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(cost_aware_lru) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_lru(SlowFun(nb_call), 2);
+    lru.enable_cost_aware_eviction();
+
+    // cache = { 20 -> 20, 0 -> 0 }
+    BOOST_CHECK_EQUAL(lru(20), 20);
+    BOOST_CHECK_EQUAL(lru(0), 0);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+
+    // 20 is the least recently used but the most expensive, 0 is evicted
+    BOOST_CHECK_EQUAL(lru(1), 1);
+    BOOST_CHECK_EQUAL(lru(20), 20);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+    BOOST_CHECK_EQUAL(lru(0), 0);
+    BOOST_CHECK_EQUAL(nb_call, 4);
+
+    // with the aging, cheap entries end up evicting the unused expensive one
+    for (int i = 0; i < 100; ++i) {
+        lru(i % 2);
+    }
+    BOOST_CHECK_EQUAL(lru(0), 0);
+    BOOST_CHECK_EQUAL(lru(1), 1);
+    const auto nb_call_before = nb_call;
+    BOOST_CHECK_EQUAL(lru(20), 20);
+    BOOST_CHECK_EQUAL(nb_call, nb_call_before + 1);
+}
+
+BOOST_AUTO_TEST_CASE(cost_aware_concurrent_lru) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(SlowFun(nb_call), 2);
+    lru.enable_cost_aware_eviction();
+
+    BOOST_CHECK_EQUAL(*lru(20), 20);
+    BOOST_CHECK_EQUAL(*lru(0), 0);
+    BOOST_CHECK_EQUAL(*lru(1), 1);
+    BOOST_CHECK_EQUAL(*lru(20), 20);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+}
+
+BOOST_AUTO_TEST_CASE(cost_aware_concurrent_lru_warmup) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(SlowFun(nb_call), 2);
+    lru.enable_cost_aware_eviction();
+
+    // the costs of the warmed keys are known, 5 is the cheapest
+    lru.warmup(std::vector<int>{5, 40});
+    BOOST_CHECK_EQUAL(nb_call, 2);
+    BOOST_CHECK_EQUAL(*lru(1), 1);
+    BOOST_CHECK_EQUAL(*lru(40), 40);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+}
+
+BOOST_AUTO_TEST_CASE(lru_ttl) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_lru(Fun(nb_call), 2);
+    const auto ttl = std::chrono::milliseconds(200);
+    lru.set_ttl(ttl);
+
+    BOOST_CHECK_EQUAL(lru(1), 2);
+    BOOST_CHECK_EQUAL(lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 1);
+
+    // the entry has expired, it is computed again
+    std::this_thread::sleep_for(ttl * 3 / 2);
+    BOOST_CHECK_EQUAL(lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+    BOOST_CHECK_EQUAL(lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+}
+
+// a function depending on a version of the data, usable from several threads
+struct VersionedFun {
+    typedef int const& argument_type;
+    using result_type = int;
+    std::atomic<int>& version;
+    std::atomic<size_t>& nb_call;
+    VersionedFun(std::atomic<int>& v, std::atomic<size_t>& nb): version(v), nb_call(nb) {}
+    int operator()(const int& i) const { ++nb_call; return i * 2 + version; }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_refresh_ahead) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version, nb_call), 2);
+    const auto ttl = std::chrono::milliseconds(100);
+    lru.set_ttl(ttl);
+    lru.enable_refresh_ahead();
+
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 1);
+
+    // the data changes, and the entry expires
+    version = 1;
+    std::this_thread::sleep_for(ttl * 3 / 2);
+
+    // the stale value is served while it is refreshed in background
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(lru.get_nb_refresh(), 1);
+
+    // once computed, the fresh value is used
+    BOOST_CHECK(eventually([&]() { return *lru(1) == 3; }));
+    BOOST_CHECK_EQUAL(*lru(1), 3);
+    // only one refresh by key
+    BOOST_CHECK_EQUAL(lru.get_nb_refresh(), 1);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+    BOOST_CHECK_EQUAL(lru.get_nb_cache_miss(), 1);
+
+    // a refresh finished before a clear is not installed after it
+    version = 2;
+    std::this_thread::sleep_for(ttl * 3 / 2);
+    BOOST_CHECK_EQUAL(*lru(1), 3);
+    BOOST_CHECK(eventually([&]() { return nb_call == 3; }));
+    version = 3;
+    lru.clear();
+    BOOST_CHECK_EQUAL(*lru(1), 5);
+    std::this_thread::sleep_for(ttl * 3 / 2);
+    BOOST_CHECK_EQUAL(*lru(1), 5);
+    BOOST_CHECK(eventually([&]() { return nb_call == 5; }));
+    BOOST_CHECK_EQUAL(*lru(1), 5);
+}
+
+// a VersionedFun blocked until the gate is opened
+struct GatedFun {
+    typedef int const& argument_type;
+    using result_type = int;
+    VersionedFun fun;
+    std::atomic<bool>& open;
+    GatedFun(VersionedFun f, std::atomic<bool>& o): fun(f), open(o) {}
+    int operator()(const int& i) const {
+        while (!open) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return fun(i);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_refresh_ahead_limit) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    std::atomic<bool> open{true};
+    auto lru = navitia::make_concurrent_lru(GatedFun(VersionedFun(version, nb_call), open), 10);
+    const auto ttl = std::chrono::milliseconds(100);
+    lru.set_ttl(ttl);
+    BOOST_CHECK_THROW(lru.enable_refresh_ahead(0), std::invalid_argument);
+    lru.enable_refresh_ahead(1);
+
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    version = 1;
+    open = false;
+    std::this_thread::sleep_for(ttl * 3 / 2);
+
+    // only one refresh is running, the other stale entry is served as is
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    BOOST_CHECK_EQUAL(lru.get_nb_refresh(), 1);
+
+    open = true;
+    BOOST_CHECK(eventually([&]() { return *lru(1) == 3; }));
+    // the running refresh has ended, the other one can start
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    BOOST_CHECK_EQUAL(lru.get_nb_refresh(), 2);
+    BOOST_CHECK(eventually([&]() { return *lru(2) == 5; }));
+    BOOST_CHECK_EQUAL(nb_call, 4);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_clear_during_refresh) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    std::atomic<bool> open{true};
+    auto lru = navitia::make_concurrent_lru(GatedFun(VersionedFun(version, nb_call), open), 10);
+    lru.set_ttl(std::chrono::milliseconds(20));
+    lru.enable_refresh_ahead(1);
+
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    version = 1;
+    open = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(lru.get_nb_refresh(), 1);
+
+    // clear does not wait for the blocked refresh
+    auto cleared = std::async(std::launch::async, [&]() { lru.clear(); });
+    const auto status = cleared.wait_for(std::chrono::seconds(1));
+    BOOST_CHECK(status == std::future_status::ready);
+    open = true;
+    cleared.get();
+    BOOST_CHECK_EQUAL(*lru(1), 3);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_front_cache) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version, nb_call), 10);
+    lru.enable_front_cache(2);
+
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    BOOST_CHECK_EQUAL(*lru(2), 4);
+    BOOST_CHECK_EQUAL(nb_call, 2);
+    // the hits in the front cache don't reach the shared cache
+    BOOST_CHECK_EQUAL(lru.get_nb_front_cache_hits(), 2);
+    BOOST_CHECK_EQUAL(lru.get_nb_calls(), 2);
+
+    // 1 is evicted from the front cache but is still in the shared cache
+    BOOST_CHECK_EQUAL(*lru(3), 6);
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+    BOOST_CHECK_EQUAL(lru.get_nb_calls(), 4);
+
+    // each thread has its own front cache
+    std::thread([&]() {
+        BOOST_CHECK_EQUAL(*lru(1), 2);
+        BOOST_CHECK_EQUAL(*lru(1), 2);
+    }).join();
+    BOOST_CHECK_EQUAL(lru.get_nb_calls(), 5);
+    BOOST_CHECK_EQUAL(lru.get_nb_front_cache_hits(), 3);
+
+    // the front caches of the finished threads release their values, keeping their hits
+    const auto value = lru(2);
+    const auto use_count = value.use_count();
+    for (size_t i = 0; i < 10; ++i) {
+        std::thread([&]() {
+            BOOST_CHECK_EQUAL(*lru(2), 4);
+            BOOST_CHECK_EQUAL(*lru(2), 4);
+        }).join();
+    }
+    BOOST_CHECK_EQUAL(value.use_count(), use_count);
+    BOOST_CHECK_EQUAL(lru.get_nb_front_cache_hits(), 13);
+
+    // clearing the cache invalidates the front caches
+    version = 1;
+    lru.clear();
+    BOOST_CHECK_EQUAL(*lru(1), 3);
+    BOOST_CHECK_EQUAL(*lru(1), 3);
+    BOOST_CHECK_EQUAL(nb_call, 4);
+}
+
+BOOST_AUTO_TEST_CASE(lru_get_many) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_lru(Fun(nb_call), 10);
+    BOOST_CHECK_EQUAL(lru(1), 2);
+
+    const auto values = lru.get_many({1, 2, 3, 2});
+    const std::vector<int> expected = {2, 4, 6, 4};
+    BOOST_CHECK_EQUAL_COLLECTIONS(values.begin(), values.end(), expected.begin(), expected.end());
+    BOOST_CHECK_EQUAL(nb_call, 3);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_get_many) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version, nb_call), 100);
+    BOOST_CHECK_EQUAL(*lru(1), 2);
+
+    std::vector<int> keys;
+    for (int i = 0; i < 50; ++i) {
+        keys.push_back(i % 25);
+    }
+    // the misses are computed by 4 threads, only once by key
+    const auto values = lru.get_many(keys, 4);
+    BOOST_REQUIRE_EQUAL(values.size(), 50);
+    for (size_t i = 0; i < values.size(); ++i) {
+        BOOST_CHECK_EQUAL(*values[i], keys[i] * 2);
+    }
+    BOOST_CHECK_EQUAL(nb_call, 25);
+    BOOST_CHECK_EQUAL(lru.get_nb_cache_miss(), 25);
+    BOOST_CHECK_EQUAL(lru.get_nb_calls(), 51);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_warmup_from_keys) {
+    std::atomic<int> version{0};
+    std::atomic<size_t> nb_call{0};
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version, nb_call), 3);
+    for (int i = 0; i < 4; ++i) {
+        lru(i);
+    }
+    lru(1);
+
+    // cache = { 1, 3, 2 }
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        lru.save_keys(oa);
+    }
+
+    // after a restart
+    nb_call = 0;
+    auto other = navitia::make_concurrent_lru(VersionedFun(version, nb_call), 3);
+    boost::archive::binary_iarchive ia(ss);
+    navitia::WarmupOptions options;
+    options.nb_threads = 2;
+    const auto stats = other.warmup_from_keys(ia, options);
+    BOOST_CHECK_EQUAL(stats.nb_keys, 3);
+    BOOST_CHECK_EQUAL(stats.nb_warmed, 3);
+    BOOST_CHECK_EQUAL(other.get_warmup_progress().nb_warmed, 3);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+    // the warmed keys are counted as calls
+    BOOST_CHECK_EQUAL(other.get_nb_calls(), 3);
+    BOOST_CHECK_EQUAL(other.get_nb_cache_miss(), 3);
+
+    // the order of the keys has been kept: 2 is the least recently used
+    BOOST_CHECK_EQUAL(*other(1), 2);
+    BOOST_CHECK_EQUAL(*other(3), 6);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+    BOOST_CHECK_EQUAL(*other(4), 8);
+    BOOST_CHECK_EQUAL(*other(2), 4);
+    BOOST_CHECK_EQUAL(nb_call, 5);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_warmup_time_budget) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(SlowFun(nb_call), 10);
+    for (int i = 20; i < 25; ++i) {
+        lru(i);
+    }
+
+    navitia::WarmupOptions options;
+    options.time_budget = std::chrono::milliseconds(30);
+    nb_call = 0;
+    auto other = navitia::make_concurrent_lru(SlowFun(nb_call), 10);
+    const auto stats = other.warmup(lru, options);
+    BOOST_CHECK_EQUAL(stats.nb_keys, 5);
+    BOOST_CHECK_LT(stats.nb_warmed, 5);
+    BOOST_CHECK_EQUAL(nb_call, stats.nb_warmed);
+
+    // the keys not warmed in time are computed when used
+    for (int i = 20; i < 25; ++i) {
+        BOOST_CHECK_EQUAL(*other(i), i);
+    }
+    BOOST_CHECK_EQUAL(nb_call, 5);
+    BOOST_CHECK_EQUAL(other.get_nb_calls(), 10);
+    BOOST_CHECK_EQUAL(other.get_nb_cache_miss(), 5);
+    // they have been computed by this thread, without waiting for another one,
+    // the time spent in the cache itself is small compared to the computations
+    const auto other_stats = other.get_stats();
+    BOOST_CHECK_LT(other_stats.future_wait_time.count(), other_stats.compute_time.count() / 4);
+}
+
+BOOST_AUTO_TEST_CASE(lru_stats) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_lru(SlowFun(nb_call), 2);
+    lru(0);
+    lru(0);
+    lru(2);
+    lru(3);
+
+    const auto stats = lru.get_stats();
+    BOOST_CHECK_EQUAL(stats.nb_calls, 4);
+    BOOST_CHECK_EQUAL(stats.nb_hits, 1);
+    BOOST_CHECK_EQUAL(stats.nb_misses, 3);
+    BOOST_CHECK_EQUAL(stats.nb_evictions, 1);
+    BOOST_CHECK_EQUAL(stats.size, 2);
+    BOOST_CHECK_EQUAL(stats.max_size, 2);
+    BOOST_REQUIRE_EQUAL(stats.compute_histogram.size(), size_t(navitia::LatencyHistogram::nb_buckets));
+    size_t nb_computed = 0;
+    for (auto count : stats.compute_histogram) {
+        nb_computed += count;
+    }
+    BOOST_CHECK_EQUAL(nb_computed, 3);
+    // sleeping 3 ms lasts more than 2^11 µs
+    BOOST_CHECK_EQUAL(stats.compute_histogram[0] + stats.compute_histogram[1], 1);
+    BOOST_CHECK_GE(stats.compute_time.count(), 5000);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_stats) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(SlowFun(nb_call), 10);
+
+    // a thread waits for the value computed by another one
+    std::thread first([&]() { lru(50); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    BOOST_CHECK_EQUAL(*lru(50), 50);
+    first.join();
+    BOOST_CHECK_EQUAL(nb_call, 1);
+
+    const auto stats = lru.get_stats();
+    BOOST_CHECK_EQUAL(stats.nb_calls, 2);
+    BOOST_CHECK_EQUAL(stats.nb_hits, 1);
+    BOOST_CHECK_EQUAL(stats.nb_misses, 1);
+    BOOST_CHECK_EQUAL(stats.size, 1);
+    BOOST_CHECK_GE(stats.compute_time.count(), 50000);
+    BOOST_CHECK_GE(stats.future_wait_time.count(), 20000);
+}
@@ -0,0 +1,105 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#include "utils/mmap_idx_map.h"
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE mmap_idx_map_test
+#include <boost/test/unit_test.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+struct Stop {
+    navitia::idx_t idx;
+};
+
+struct Label {
+    uint32_t time;
+    uint16_t nb_transfers;
+};
+
+struct TmpFile {
+    std::string path;
+    TmpFile() {
+        char name[] = "/tmp/mmap_idx_map_test_XXXXXX";
+        ::close(mkstemp(name));
+        path = name;
+    }
+    ~TmpFile() { std::remove(path.c_str()); }
+};
+
+BOOST_AUTO_TEST_CASE(mmap_idx_map_write_load) {
+    TmpFile file;
+    navitia::IdxMap<Stop, Label> map(1000);
+    for (auto elt : map) {
+        elt.second = {elt.first.val * 2, uint16_t(elt.first.val % 7)};
+    }
+    navitia::write_mmap_idx_map(file.path, map);
+
+    const navitia::MmapIdxMap<Stop, Label> mapped(file.path);
+    BOOST_REQUIRE_EQUAL(mapped.size(), 1000);
+    for (const auto& elt : mapped) {
+        BOOST_CHECK_EQUAL(elt.second.time, map[elt.first].time);
+        BOOST_CHECK_EQUAL(elt.second.nb_transfers, map[elt.first].nb_transfers);
+    }
+    BOOST_CHECK_EQUAL(mapped.at(navitia::Idx<Stop>(999)).time, 1998);
+    BOOST_CHECK_THROW(mapped.at(navitia::Idx<Stop>(1000)), std::out_of_range);
+
+    // the copies share the mapping
+    const auto copy = mapped;
+    BOOST_CHECK_EQUAL(&copy[navitia::Idx<Stop>(0)], &mapped[navitia::Idx<Stop>(0)]);
+}
+
+BOOST_AUTO_TEST_CASE(mmap_idx_map_empty) {
+    TmpFile file;
+    navitia::write_mmap_idx_map(file.path, navitia::IdxMap<Stop, int>());
+    const navitia::MmapIdxMap<Stop, int> mapped(file.path);
+    BOOST_CHECK_EQUAL(mapped.size(), 0);
+    BOOST_CHECK(mapped.begin() == mapped.end());
+}
+
+BOOST_AUTO_TEST_CASE(mmap_idx_map_wrong_file) {
+    TmpFile file;
+    navitia::write_mmap_idx_map(file.path, navitia::IdxMap<Stop, uint32_t>(10, 42));
+    // another type
+    BOOST_CHECK_THROW((navitia::MmapIdxMap<Stop, uint64_t>(file.path)), navitia::MmapIdxMapError);
+
+    // truncated file
+    BOOST_REQUIRE_EQUAL(::truncate(file.path.c_str(), 64 + 9 * 4), 0);
+    BOOST_CHECK_THROW((navitia::MmapIdxMap<Stop, uint32_t>(file.path)), navitia::MmapIdxMapError);
+
+    // not a MmapIdxMap
+    std::ofstream(file.path) << "this is not the file you are looking for, this is not the file you are looking for";
+    BOOST_CHECK_THROW((navitia::MmapIdxMap<Stop, uint32_t>(file.path)), navitia::MmapIdxMapError);
+
+    BOOST_CHECK_THROW((navitia::MmapIdxMap<Stop, uint32_t>("/this/file/does/not/exist")), navitia::MmapIdxMapError);
+}
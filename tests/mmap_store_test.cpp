@@ -0,0 +1,234 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#include "utils/mmap_store.h"
+#include "utils/lru.h"
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE mmap_store_test
+#include <boost/test/unit_test.hpp>
+#include <boost/serialization/string.hpp>
+
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+struct TmpFile {
+    std::string path;
+    TmpFile() {
+        char name[] = "/tmp/mmap_store_test_XXXXXX";
+        ::close(mkstemp(name));
+        path = name;
+    }
+    ~TmpFile() { std::remove(path.c_str()); }
+};
+
+BOOST_AUTO_TEST_CASE(mmap_store_put_get) {
+    TmpFile file;
+    {
+        navitia::MmapStore store(file.path, 1000);
+        std::string value;
+        BOOST_CHECK(!store.get("bob", value));
+        store.put("bob", "the sponge");
+        store.put("patrick", "the star");
+        BOOST_REQUIRE(store.get("bob", value));
+        BOOST_CHECK_EQUAL(value, "the sponge");
+        store.put("bob", "the square");
+        BOOST_REQUIRE(store.get("bob", value));
+        BOOST_CHECK_EQUAL(value, "the square");
+        BOOST_CHECK_EQUAL(store.size(), 2);
+        BOOST_CHECK_EQUAL(store.get_nb_hits(), 2);
+        BOOST_CHECK_EQUAL(store.get_nb_misses(), 1);
+    }
+
+    // the content is kept after a restart
+    navitia::MmapStore store(file.path, 1000);
+    std::string value;
+    BOOST_CHECK_EQUAL(store.size(), 2);
+    BOOST_REQUIRE(store.get("bob", value));
+    BOOST_CHECK_EQUAL(value, "the square");
+    BOOST_REQUIRE(store.get("patrick", value));
+    BOOST_CHECK_EQUAL(value, "the star");
+
+    // the old value of bob is dropped by the compaction
+    const auto size = store.file_size();
+    store.compact();
+    BOOST_CHECK_LT(store.file_size(), size);
+    BOOST_REQUIRE(store.get("bob", value));
+    BOOST_CHECK_EQUAL(value, "the square");
+
+    store.clear();
+    BOOST_CHECK_EQUAL(store.size(), 0);
+    BOOST_CHECK(!store.get("bob", value));
+}
+
+BOOST_AUTO_TEST_CASE(mmap_store_format) {
+    TmpFile file;
+    {
+        navitia::MmapStore store(file.path, 1000, "v1");
+        store.put("bob", "the sponge");
+    }
+    {
+        navitia::MmapStore store(file.path, 1000, "v1");
+        BOOST_CHECK_EQUAL(store.size(), 1);
+    }
+    // the records of another format are dropped
+    navitia::MmapStore store(file.path, 1000, "v2");
+    std::string value;
+    BOOST_CHECK_EQUAL(store.size(), 0);
+    BOOST_CHECK(!store.get("bob", value));
+    store.put("bob", "the square");
+    BOOST_REQUIRE(store.get("bob", value));
+    BOOST_CHECK_EQUAL(value, "the square");
+}
+
+BOOST_AUTO_TEST_CASE(mmap_store_bounded_size) {
+    TmpFile file;
+    navitia::MmapStore store(file.path, 1000);
+    for (int i = 0; i < 100; ++i) {
+        store.put("key_" + std::to_string(i), std::string(50, 'a'));
+        BOOST_CHECK_LE(store.file_size(), 1000);
+    }
+    // the most recent values are kept
+    std::string value;
+    BOOST_CHECK(store.get("key_99", value));
+    BOOST_CHECK(!store.get("key_0", value));
+}
+
+struct Fun {
+    typedef int const& argument_type;
+    using result_type = std::string;
+    size_t& nb_call;
+    Fun(size_t& nb) : nb_call(nb) {}
+    std::string operator()(const int& i) const {
+        ++nb_call;
+        return std::to_string(i);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_with_mmap_tier) {
+    TmpFile file;
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(Fun(nb_call), 2);
+    auto tier = std::make_shared<navitia::MmapTier<int, std::string>>(file.path, 1 << 20);
+    lru.set_second_tier(tier);
+
+    BOOST_CHECK_EQUAL(*lru(1), "1");
+    BOOST_CHECK_EQUAL(*lru(2), "2");
+    // 1 is evicted to the second tier
+    BOOST_CHECK_EQUAL(*lru(3), "3");
+    BOOST_CHECK_EQUAL(tier->get_store().size(), 1);
+    BOOST_CHECK_EQUAL(nb_call, 3);
+
+    // and is loaded from it instead of being computed
+    BOOST_CHECK_EQUAL(*lru(1), "1");
+    BOOST_CHECK_EQUAL(nb_call, 3);
+    BOOST_CHECK_EQUAL(lru.get_nb_cache_miss(), 4);
+    BOOST_CHECK_EQUAL(tier->get_store().get_nb_hits(), 1);
+
+    lru.clear();
+    BOOST_CHECK_EQUAL(tier->get_store().size(), 0);
+    BOOST_CHECK_EQUAL(*lru(2), "2");
+    BOOST_CHECK_EQUAL(nb_call, 4);
+}
+
+struct VersionedFun {
+    typedef int const& argument_type;
+    using result_type = std::string;
+    int& version;
+    VersionedFun(int& v) : version(v) {}
+    std::string operator()(const int& i) const { return std::to_string(i) + "v" + std::to_string(version); }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_with_mmap_tier_ttl) {
+    TmpFile file;
+    int version = 0;
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version), 1);
+    auto tier = std::make_shared<navitia::MmapTier<int, std::string>>(file.path, 1 << 20);
+    lru.set_second_tier(tier);
+    const auto ttl = std::chrono::milliseconds(200);
+    lru.set_ttl(ttl);
+
+    // the time when the value was computed is kept by the second tier
+    const auto now = std::chrono::system_clock::now();
+    tier->put(42, "42", now);
+    std::chrono::system_clock::time_point computed;
+    BOOST_CHECK_EQUAL(*tier->get(42, computed), "42");
+    BOOST_CHECK(computed == now);
+
+    // a value younger than the ttl is loaded from the second tier
+    BOOST_CHECK_EQUAL(*lru(1), "1v0");
+    BOOST_CHECK_EQUAL(*lru(2), "2v0");
+    version = 1;
+    BOOST_CHECK_EQUAL(*lru(1), "1v0");
+    BOOST_CHECK_EQUAL(*lru(2), "2v0");
+
+    // but not after the ttl
+    std::this_thread::sleep_for(ttl * 3 / 2);
+    BOOST_CHECK_EQUAL(*lru(1), "1v1");
+}
+
+// a second tier whose records can't be read
+struct BrokenTier : public navitia::SecondTier<int, std::string> {
+    std::shared_ptr<const std::string> get(const int&, time_point&) override { throw std::bad_alloc(); }
+    void put(const int&, const std::string&, time_point) override {}
+    void clear() override {}
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_with_broken_tier) {
+    size_t nb_call = 0;
+    auto lru = navitia::make_concurrent_lru(Fun(nb_call), 1);
+    lru.set_second_tier(std::make_shared<BrokenTier>());
+
+    // the values are computed instead
+    BOOST_CHECK_EQUAL(*lru(1), "1");
+    BOOST_CHECK_EQUAL(*lru(2), "2");
+    BOOST_CHECK_EQUAL(*lru(1), "1");
+    BOOST_CHECK_EQUAL(nb_call, 3);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_lru_with_mmap_tier_dated_back) {
+    TmpFile file;
+    int version = 0;
+    auto lru = navitia::make_concurrent_lru(VersionedFun(version), 1);
+    lru.set_second_tier(std::make_shared<navitia::MmapTier<int, std::string>>(file.path, 1 << 20));
+    const auto ttl = std::chrono::milliseconds(200);
+    lru.set_ttl(ttl);
+
+    const auto computed = std::chrono::steady_clock::now();
+    BOOST_CHECK_EQUAL(*lru(1), "1v0");
+    BOOST_CHECK_EQUAL(*lru(2), "2v0");
+    std::this_thread::sleep_until(computed + ttl / 2);
+    // loaded from the second tier, but as old as its computation
+    BOOST_CHECK_EQUAL(*lru(1), "1v0");
+    version = 1;
+    std::this_thread::sleep_until(computed + ttl + ttl / 4);
+    BOOST_CHECK_EQUAL(*lru(1), "1v1");
+}
@@ -34,6 +34,14 @@ www.navitia.io
 #define BOOST_TEST_MODULE obj_factory_test
 #include <boost/test/unit_test.hpp>
 #include "utils/functions.h"
+#include "utils/serialization_vector.h"
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/unique_ptr.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include <sstream>
 
 struct HeaderInt {
     uint32_t idx;
@@ -184,3 +192,443 @@ BOOST_AUTO_TEST_CASE(erase_member_into_obj_factory) {
     }
 }
 
+
+static void fill(navitia::ObjFactory<HeaderInt>& obj_factory, int nb) {
+    for (int i = 0; i < nb; ++i) {
+        obj_factory.emplace("Val_" + std::to_string(i))->val = i;
+    }
+}
+
+static void check_reindexed(const navitia::ObjFactory<HeaderInt>& obj_factory, const std::vector<int>& values) {
+    BOOST_REQUIRE_EQUAL(obj_factory.size(), values.size());
+    for (size_t j = 0; j < values.size(); ++j) {
+        const auto* obj = obj_factory[navitia::Idx<HeaderInt>(j)];
+        BOOST_REQUIRE(obj != nullptr);
+        BOOST_CHECK_EQUAL(obj->idx, j);
+        BOOST_CHECK_EQUAL(obj->val, values[j]);
+        BOOST_CHECK_EQUAL(obj_factory[obj->uri], obj);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(erase_many_from_obj_factory) {
+    {
+        navitia::ObjFactory<HeaderInt> obj_factory;
+        fill(obj_factory, 6);
+        BOOST_CHECK_EQUAL(obj_factory.erase_many(std::vector<std::string>{"Val_1", "Val_4", "Val_10", "Val_1"}), 2);
+        BOOST_CHECK(!obj_factory.exists("Val_4"));
+        check_reindexed(obj_factory, {0, 2, 3, 5});
+    }
+    {
+        navitia::ObjFactory<HeaderInt> obj_factory;
+        fill(obj_factory, 6);
+        using Idx = navitia::Idx<HeaderInt>;
+        BOOST_CHECK_EQUAL(obj_factory.erase_many(std::vector<Idx>{Idx(0), Idx(5), Idx(10)}), 2);
+        BOOST_CHECK(!obj_factory.exists("Val_0"));
+        check_reindexed(obj_factory, {1, 2, 3, 4});
+    }
+}
+
+BOOST_AUTO_TEST_CASE(obj_factory_tombstones) {
+    using Idx = navitia::Idx<HeaderInt>;
+    navitia::ObjFactory<HeaderInt> obj_factory;
+    fill(obj_factory, 5);
+    obj_factory.enable_tombstones();
+
+    // the idx do not change
+    BOOST_CHECK(obj_factory.erase("Val_1"));
+    BOOST_CHECK(obj_factory.erase(Idx(3)));
+    BOOST_CHECK(!obj_factory.erase(Idx(3)));
+    BOOST_CHECK_EQUAL(obj_factory.erase_many(std::vector<std::string>{"Val_0", "Val_1"}), 1);
+    BOOST_CHECK_EQUAL(obj_factory.size(), 5);
+    BOOST_CHECK_EQUAL(obj_factory.get_nb_tombstones(), 3);
+    BOOST_CHECK(!obj_factory.exists(Idx(1)));
+    BOOST_CHECK(obj_factory[Idx(1)] == nullptr);
+    BOOST_CHECK_EQUAL(obj_factory[Idx(4)]->val, 4);
+    BOOST_CHECK_EQUAL(obj_factory["Val_2"]->idx, 2);
+    // the iteration skips the tombstones
+    size_t nb_alive = 0;
+    for (const auto& obj : obj_factory) {
+        BOOST_CHECK(obj != nullptr);
+        ++nb_alive;
+    }
+    BOOST_CHECK_EQUAL(nb_alive, 2);
+
+    // new objects are added after the tombstones
+    BOOST_CHECK_EQUAL(obj_factory.emplace("Val_5")->idx, 5);
+
+    obj_factory.compact();
+    BOOST_CHECK_EQUAL(obj_factory.get_nb_tombstones(), 0);
+    check_reindexed(obj_factory, {2, 4, 0});
+
+    // leaving the tombstone mode compacts
+    BOOST_CHECK(obj_factory.erase("Val_4"));
+    BOOST_CHECK_EQUAL(obj_factory.size(), 3);
+    obj_factory.enable_tombstones(false);
+    check_reindexed(obj_factory, {2, 0});
+    BOOST_CHECK(obj_factory.erase("Val_2"));
+    check_reindexed(obj_factory, {0});
+}
+
+struct HeaderCounted {
+    static int nb_alive;
+    HeaderCounted(int v = 0) : val(v) { ++nb_alive; }
+    HeaderCounted(const HeaderCounted&) = delete;
+    ~HeaderCounted() { --nb_alive; }
+    uint32_t idx;
+    std::string uri;
+    int val;
+};
+int HeaderCounted::nb_alive = 0;
+
+BOOST_AUTO_TEST_CASE(slab_obj_factory) {
+    using Idx = navitia::Idx<HeaderCounted>;
+    {
+        navitia::ObjFactory<HeaderCounted, navitia::SlabStorage<4>> obj_factory;
+        for (int i = 0; i < 10; ++i) {
+            obj_factory.emplace("Val_" + std::to_string(i), i);
+        }
+        BOOST_CHECK_EQUAL(HeaderCounted::nb_alive, 10);
+        BOOST_CHECK_EQUAL(obj_factory.get_pool().nb_slabs(), 3);
+        // the objects of a slab are contiguous
+        BOOST_CHECK_EQUAL(obj_factory[Idx(1)], obj_factory[Idx(0)] + 1);
+        BOOST_CHECK_EQUAL(obj_factory[Idx(3)], obj_factory[Idx(0)] + 3);
+
+        int sum = 0;
+        for (const auto& obj : obj_factory) {
+            sum += obj->val;
+        }
+        BOOST_CHECK_EQUAL(sum, 45);
+
+        // the memory of the erased object is reused
+        const auto* erased = obj_factory["Val_2"];
+        BOOST_CHECK(obj_factory.erase("Val_2"));
+        BOOST_CHECK_EQUAL(HeaderCounted::nb_alive, 9);
+        BOOST_CHECK_EQUAL(obj_factory[Idx(2)]->val, 3);
+        BOOST_CHECK_EQUAL(obj_factory.emplace("Val_10", 10), erased);
+        BOOST_CHECK_EQUAL(obj_factory.get_pool().nb_slabs(), 3);
+
+        BOOST_CHECK_EQUAL(obj_factory.erase_many(std::vector<std::string>{"Val_0", "Val_9"}), 2);
+        BOOST_CHECK_EQUAL(HeaderCounted::nb_alive, 8);
+        BOOST_CHECK_EQUAL(obj_factory.size(), 8);
+        BOOST_CHECK_EQUAL(obj_factory["Val_10"]->idx, 7);
+
+        // the objects do not move with the factory
+        const auto* obj = obj_factory["Val_5"];
+        auto moved = std::move(obj_factory);
+        BOOST_CHECK_EQUAL(moved["Val_5"], obj);
+    }
+    BOOST_CHECK_EQUAL(HeaderCounted::nb_alive, 0);
+}
+
+BOOST_AUTO_TEST_CASE(frozen_obj_factory) {
+    using Idx = navitia::Idx<HeaderInt>;
+    navitia::ObjFactory<HeaderInt> obj_factory;
+    obj_factory.freeze();
+    BOOST_CHECK(obj_factory["Val_0"] == nullptr);
+    obj_factory.thaw();
+    fill(obj_factory, 1000);
+    obj_factory.freeze();
+    BOOST_CHECK(obj_factory.is_frozen());
+
+    for (int i = 0; i < 1000; ++i) {
+        const std::string uri = "Val_" + std::to_string(i);
+        BOOST_REQUIRE(obj_factory[uri] != nullptr);
+        BOOST_CHECK_EQUAL(obj_factory[uri]->val, i);
+        BOOST_CHECK_EQUAL(obj_factory[boost::string_ref(uri)], obj_factory[Idx(i)]);
+    }
+    // no temporary string is needed
+    const std::string text = "Val_42 and Val_43";
+    BOOST_CHECK_EQUAL(obj_factory[boost::string_ref(text).substr(0, 6)]->val, 42);
+    BOOST_CHECK_EQUAL(obj_factory.get_mut(boost::string_ref(text).substr(11))->val, 43);
+    BOOST_CHECK(obj_factory["Val_1000"] == nullptr);
+    BOOST_CHECK(!obj_factory.exists("Val_"));
+    BOOST_CHECK(obj_factory.exists("Val_999"));
+
+    // a modification thaws the factory
+    BOOST_CHECK(obj_factory.erase("Val_0"));
+    BOOST_CHECK(!obj_factory.is_frozen());
+    BOOST_CHECK_EQUAL(obj_factory["Val_1"]->idx, 0);
+    obj_factory.freeze();
+    BOOST_CHECK_EQUAL(obj_factory.get_or_create("Val_1")->val, 1);
+    BOOST_CHECK(obj_factory.is_frozen());
+    BOOST_CHECK_EQUAL(obj_factory.get_or_create("Val_1000")->idx, 999);
+    BOOST_CHECK(!obj_factory.is_frozen());
+    obj_factory.freeze();
+    BOOST_CHECK_THROW(obj_factory.emplace("Val_1"), std::logic_error);
+    BOOST_CHECK_EQUAL(obj_factory["Val_1000"]->idx, 999);
+
+    // with tombstones
+    obj_factory.enable_tombstones();
+    BOOST_CHECK(obj_factory.erase("Val_5"));
+    obj_factory.freeze();
+    BOOST_CHECK(obj_factory["Val_5"] == nullptr);
+    BOOST_CHECK_EQUAL(obj_factory["Val_6"]->idx, 5);
+    obj_factory.compact();
+    BOOST_CHECK_EQUAL(obj_factory["Val_6"]->idx, 4);
+}
+
+BOOST_AUTO_TEST_CASE(bulk_obj_factory) {
+    using Idx = navitia::Idx<HeaderInt>;
+    navitia::ObjFactory<HeaderInt> obj_factory;
+    fill(obj_factory, 10);
+    {
+        auto builder = obj_factory.bulk_builder(100000);
+        for (int i = 10; i < 100000; ++i) {
+            builder.emplace("Val_" + std::to_string(i))->val = i;
+        }
+        builder.finish(4);
+    }
+    BOOST_CHECK(obj_factory.is_frozen());
+    BOOST_REQUIRE_EQUAL(obj_factory.size(), 100000);
+    for (int i = 0; i < 100000; i += 7) {
+        const auto* obj = obj_factory["Val_" + std::to_string(i)];
+        BOOST_REQUIRE(obj != nullptr);
+        BOOST_CHECK_EQUAL(obj->val, i);
+        BOOST_CHECK_EQUAL(obj, obj_factory[Idx(i)]);
+    }
+
+    // a duplicate in the batch
+    {
+        auto builder = obj_factory.bulk_builder(2);
+        builder.emplace("New_0");
+        builder.emplace("New_0");
+        BOOST_CHECK_THROW(builder.finish(4), std::logic_error);
+    }
+    // a duplicate with an existing object
+    {
+        auto builder = obj_factory.bulk_builder(2);
+        builder.emplace("New_1");
+        builder.emplace("Val_42");
+        BOOST_CHECK_THROW(builder.finish(), std::logic_error);
+    }
+    // not finished
+    {
+        auto builder = obj_factory.bulk_builder(1);
+        builder.emplace("New_2");
+    }
+    BOOST_CHECK_EQUAL(obj_factory.size(), 100000);
+    BOOST_CHECK(obj_factory["New_0"] == nullptr);
+    BOOST_CHECK(obj_factory["New_1"] == nullptr);
+    BOOST_CHECK(obj_factory["New_2"] == nullptr);
+    BOOST_CHECK_EQUAL(obj_factory["Val_42"]->idx, 42);
+
+    std::vector<std::pair<std::string, HeaderInt>> batch(2);
+    batch[0].first = "New_3";
+    batch[0].second.val = 3;
+    batch[1].first = "New_4";
+    batch[1].second.val = 4;
+    obj_factory.insert_many(std::move(batch), 2);
+    BOOST_CHECK_EQUAL(obj_factory["New_3"]->val, 3);
+    BOOST_CHECK_EQUAL(obj_factory["New_4"]->idx, 100001);
+
+    // the factory can still be modified
+    BOOST_CHECK(obj_factory.erase("Val_0"));
+    BOOST_CHECK_EQUAL(obj_factory["New_4"]->idx, 100000);
+}
+
+struct HeaderSerializable {
+    uint32_t idx;
+    std::string uri;
+    int val = 0;
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& idx& uri& val;
+    }
+};
+
+// an object pointing to objects of a factory
+struct Link {
+    const HeaderSerializable* from = nullptr;
+    const HeaderSerializable* to = nullptr;
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& from& to;
+    }
+};
+
+// the ObjFactory format before the version 1
+struct ObjFactoryV0 {
+    std::vector<std::unique_ptr<HeaderSerializable>> vec;
+    std::unordered_map<std::string, HeaderSerializable*> map;
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& vec& map;
+    }
+};
+
+template <typename Storage>
+static void check_serialization(bool link_first) {
+    using Idx = navitia::Idx<HeaderSerializable>;
+    navitia::ObjFactory<HeaderSerializable, Storage> obj_factory;
+    for (int i = 0; i < 5; ++i) {
+        obj_factory.emplace("Val_" + std::to_string(i))->val = i;
+    }
+    obj_factory.enable_tombstones();
+    obj_factory.erase("Val_1");
+    Link link;
+    link.from = obj_factory["Val_0"];
+    link.to = obj_factory["Val_4"];
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        if (link_first) {
+            oa << link << obj_factory;
+        } else {
+            oa << obj_factory << link;
+        }
+    }
+    navitia::ObjFactory<HeaderSerializable, Storage> loaded;
+    Link loaded_link;
+    {
+        boost::archive::binary_iarchive ia(ss);
+        if (link_first) {
+            ia >> loaded_link >> loaded;
+        } else {
+            ia >> loaded >> loaded_link;
+        }
+    }
+    BOOST_CHECK(loaded.is_frozen());
+    BOOST_CHECK_EQUAL(loaded.size(), 5);
+    BOOST_CHECK_EQUAL(loaded.get_nb_tombstones(), 1);
+    BOOST_CHECK(loaded[Idx(1)] == nullptr);
+    BOOST_CHECK(loaded["Val_1"] == nullptr);
+    for (int i : {0, 2, 3, 4}) {
+        const auto* obj = loaded["Val_" + std::to_string(i)];
+        BOOST_REQUIRE(obj != nullptr);
+        BOOST_CHECK_EQUAL(obj->val, i);
+        BOOST_CHECK_EQUAL(obj->idx, i);
+        BOOST_CHECK_EQUAL(obj, loaded[Idx(i)]);
+    }
+    // the pointers to the objects are restored
+    BOOST_CHECK_EQUAL(loaded_link.from, loaded["Val_0"]);
+    BOOST_CHECK_EQUAL(loaded_link.to, loaded["Val_4"]);
+
+    loaded.compact();
+    BOOST_CHECK_EQUAL(loaded["Val_4"]->idx, 3);
+}
+
+BOOST_AUTO_TEST_CASE(obj_factory_serialization) {
+    for (const bool link_first : {false, true}) {
+        check_serialization<navitia::HeapStorage>(link_first);
+        check_serialization<navitia::SlabStorage<2>>(link_first);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(obj_factory_repack_after_load) {
+    using Idx = navitia::Idx<HeaderSerializable>;
+    navitia::ObjFactory<HeaderSerializable, navitia::SlabStorage<2>> obj_factory;
+    for (int i = 0; i < 5; ++i) {
+        obj_factory.emplace("Val_" + std::to_string(i))->val = i;
+    }
+    obj_factory.enable_tombstones();
+    obj_factory.erase("Val_1");
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << obj_factory;
+    }
+    navitia::ObjFactory<HeaderSerializable, navitia::SlabStorage<2>> loaded;
+    {
+        boost::archive::binary_iarchive ia(ss);
+        ia >> loaded;
+    }
+    // the loaded objects are not in the slabs
+    BOOST_CHECK_EQUAL(loaded.get_pool().nb_slabs(), 0);
+
+    loaded.repack();
+    BOOST_CHECK_EQUAL(loaded.get_pool().nb_slabs(), 2);
+    BOOST_CHECK_EQUAL(loaded[Idx(2)], loaded[Idx(0)] + 1);
+    BOOST_CHECK(loaded[Idx(1)] == nullptr);
+    for (int i : {0, 2, 3, 4}) {
+        const auto* obj = loaded["Val_" + std::to_string(i)];
+        BOOST_REQUIRE(obj != nullptr);
+        BOOST_CHECK_EQUAL(obj->val, i);
+        BOOST_CHECK_EQUAL(obj, loaded[Idx(i)]);
+    }
+
+    // the index of a thawed factory is updated too
+    loaded.emplace("Val_5")->val = 5;
+    loaded.repack();
+    BOOST_CHECK_EQUAL(loaded["Val_3"], loaded[Idx(3)]);
+    BOOST_CHECK_EQUAL(loaded["Val_5"]->val, 5);
+}
+
+struct Area;
+struct Point {
+    uint32_t idx;
+    std::string uri;
+    Area* area = nullptr;
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& idx& uri& area;
+    }
+};
+struct Area {
+    uint32_t idx;
+    std::string uri;
+    std::vector<Point*> points;
+    template <class Archive>
+    void serialize(Archive& ar, const unsigned int) {
+        ar& idx& uri& points;
+    }
+};
+
+// the objects of two factories pointing at each other
+BOOST_AUTO_TEST_CASE(obj_factory_serialization_cross_pointers) {
+    navitia::ObjFactory<Point> points;
+    navitia::ObjFactory<Area> areas;
+    auto* area = areas.emplace("area");
+    for (int i = 0; i < 3; ++i) {
+        auto* point = points.emplace("point_" + std::to_string(i));
+        point->area = area;
+        area->points.push_back(point);
+    }
+
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << points << areas;
+    }
+    navitia::ObjFactory<Point> loaded_points;
+    navitia::ObjFactory<Area> loaded_areas;
+    {
+        boost::archive::binary_iarchive ia(ss);
+        ia >> loaded_points >> loaded_areas;
+    }
+    const auto* loaded_area = loaded_areas["area"];
+    BOOST_REQUIRE(loaded_area != nullptr);
+    BOOST_REQUIRE_EQUAL(loaded_area->points.size(), 3);
+    for (int i = 0; i < 3; ++i) {
+        const auto* point = loaded_points["point_" + std::to_string(i)];
+        BOOST_CHECK_EQUAL(loaded_area->points[i], point);
+        BOOST_CHECK_EQUAL(point->area, loaded_area);
+        BOOST_CHECK_EQUAL(point->idx, i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(obj_factory_load_version_0) {
+    ObjFactoryV0 old;
+    for (int i = 0; i < 3; ++i) {
+        old.vec.push_back(std::make_unique<HeaderSerializable>());
+        old.vec.back()->idx = i;
+        old.vec.back()->uri = "Val_" + std::to_string(i);
+        old.vec.back()->val = i * 10;
+        old.map[old.vec.back()->uri] = old.vec.back().get();
+    }
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oa(ss);
+        oa << old;
+    }
+    navitia::ObjFactory<HeaderSerializable> loaded;
+    {
+        boost::archive::binary_iarchive ia(ss);
+        ia >> loaded;
+    }
+    BOOST_CHECK(!loaded.is_frozen());
+    BOOST_CHECK_EQUAL(loaded.size(), 3);
+    BOOST_CHECK_EQUAL(loaded["Val_2"]->val, 20);
+    BOOST_CHECK_EQUAL(loaded["Val_2"], loaded[navitia::Idx<HeaderSerializable>(2)]);
+}
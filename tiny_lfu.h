@@ -0,0 +1,150 @@
+/* Copyright © 2001-2015, Hove and/or its affiliates. All rights reserved.
+
+This file is part of Navitia,
+    the software to build cool stuff with public transport.
+
+Hope you'll enjoy and contribute to this project,
+    powered by Hove (www.hove.com).
+Help us simplify mobility and open public transport:
+    a non ending quest to the responsive locomotion way of traveling!
+
+LICENCE: This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+Stay tuned using
+twitter @navitia
+IRC #navitia on freenode
+https://groups.google.com/d/forum/navitia
+www.navitia.io
+*/
+
+#pragma once
+
+#include <boost/functional/hash.hpp>
+
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+namespace navitia {
+
+// Admission policy of a Lru letting every new entry in the cache:
+// this is the plain least recently used eviction.
+struct NoAdmission {
+    template <typename K>
+    void record(const K&) {}
+    template <typename K>
+    bool admit(const K&, const K&) const {
+        return true;
+    }
+};
+
+/*
+ * TinyLFU admission policy
+ *
+ * The access frequency of each key is approximated by a count-min
+ * sketch: 4 rows of small saturating counters indexed by 4 different
+ * hashes of the key, the estimation being the minimum of the 4
+ * counters. A new entry is only allowed to evict the least recently
+ * used entry of a full cache if it has been accessed more often than
+ * the victim, so a scan of one-off keys can't flush the hot entries.
+ *
+ * To follow the changes of popularity, all the counters are halved
+ * each time `sample_size` accesses have been recorded.
+ *
+ * The keys must be hashable with boost::hash.
+ */
+class TinyLfu {
+public:
+    // nb_counters is rounded up to a power of 2, it should be around the
+    // size of the cache. By default, the sketch is aged every 10 * nb_counters accesses.
+    explicit TinyLfu(size_t nb_counters = 1024, size_t sample = 0) {
+        if (nb_counters < 1) {
+            throw std::invalid_argument("nb_counters must be strictly positive");
+        }
+        size_t width = 1;
+        while (width < nb_counters) {
+            width <<= 1;
+        }
+        width_mask = width - 1;
+        counters.assign(depth * width, 0);
+        sample_size = sample == 0 ? 10 * width : sample;
+    }
+
+    template <typename K>
+    void record(const K& key) {
+        increment(boost::hash<K>()(key));
+    }
+
+    // Does the candidate deserve to evict the victim?
+    template <typename K>
+    bool admit(const K& candidate, const K& victim) const {
+        return frequency(boost::hash<K>()(candidate)) > frequency(boost::hash<K>()(victim));
+    }
+
+    template <typename K>
+    uint8_t estimate(const K& key) const {
+        return frequency(boost::hash<K>()(key));
+    }
+
+private:
+    static constexpr size_t depth = 4;
+    static constexpr uint8_t max_count = 15;
+
+    std::vector<uint8_t> counters;
+    size_t width_mask = 0;
+    size_t sample_size = 0;
+    size_t nb_additions = 0;
+
+    size_t index(size_t hash, size_t row) const {
+        static constexpr std::array<uint64_t, depth> seeds = {
+            {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0xD6E8FEB86659FD93ULL}};
+        uint64_t h = (uint64_t(hash) + row) * seeds[row];
+        h ^= h >> 32;
+        return row * (width_mask + 1) + (h & width_mask);
+    }
+
+    uint8_t frequency(size_t hash) const {
+        uint8_t res = max_count;
+        for (size_t row = 0; row < depth; ++row) {
+            res = std::min(res, counters[index(hash, row)]);
+        }
+        return res;
+    }
+
+    void increment(size_t hash) {
+        bool added = false;
+        for (size_t row = 0; row < depth; ++row) {
+            auto& counter = counters[index(hash, row)];
+            if (counter < max_count) {
+                ++counter;
+                added = true;
+            }
+        }
+        if (added && ++nb_additions >= sample_size) {
+            age();
+        }
+    }
+
+    // halve all the counters, so that old popularity fades away
+    void age() {
+        for (auto& counter : counters) {
+            counter >>= 1;
+        }
+        nb_additions /= 2;
+    }
+};
+
+}  // namespace navitia